@@ -0,0 +1,38 @@
+    .syntax unified
+    .text
+
+    /*
+     * CRC-32 (zlib polynomial) over a memory range, so that flash can be
+     * verified without reading it back through the debug link.
+     *
+     * Arguments:
+     *   r0 - source memory ptr
+     *   r1 - crc table ptr, 256 words
+     *   r2 - count of bytes
+     *   r3 - crc value, in and out
+     */
+
+    .global crc32
+crc32:
+    mvns r3, r3
+
+loop:
+    # crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8)
+    ldrb r4, [r0]
+    adds r0, r0, #1
+    eors r4, r4, r3
+    uxtb r4, r4
+    lsls r4, r4, #2
+    ldr r4, [r1, r4]
+    lsrs r3, r3, #8
+    eors r3, r3, r4
+
+    # loop if count > 0
+    subs r2, r2, #1
+    bgt loop
+
+exit:
+    mvns r3, r3
+    bkpt
+
+    .align 2
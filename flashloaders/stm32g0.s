@@ -0,0 +1,51 @@
+    .syntax unified
+    .text
+
+    /*
+     * Arguments:
+     *   r0 - source memory ptr
+     *   r1 - target memory ptr
+     *   r2 - count of bytes
+     *   r3 - flash register offset
+     */
+
+    .global copy
+copy:
+    ldr r7, flash_base
+    ldr r5, flash_off_sr
+    add r5, r5, r7
+    ldr r7, flash_bsy
+
+loop:
+    # copy 8 bytes
+    ldr r4, [r0]
+    ldr r6, [r0, #4]
+    str r4, [r1]
+    str r6, [r1, #4]
+
+    # increment address
+    adds r0, r0, #8
+    adds r1, r1, #8
+
+wait:
+    # get FLASH_SR
+    ldr r4, [r5]
+
+    # wait until BUSY flags are reset
+    tst r4, r7
+    bne wait
+
+    # loop if count > 0
+    subs r2, r2, #8
+    bgt loop
+
+exit:
+    bkpt
+
+    .align 2
+flash_base:
+    .word 0x40022000
+flash_off_sr:
+    .word 0x10
+flash_bsy:
+    .word 0x30000
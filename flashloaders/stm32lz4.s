@@ -0,0 +1,129 @@
+    .syntax unified
+    .text
+
+    /*
+     * LZ4 loader for F2/F4/F7/L4: expands one LZ4 block into a staging
+     * buffer in SRAM and programs it, so that only the compressed chunk
+     * has to cross the debug link.
+     *
+     * Arguments:
+     *   r0 - compressed data ptr
+     *   r1 - compressed size in bytes
+     *   r2 - staging buffer ptr
+     *   r3 - target memory ptr
+     *   r4 - FLASH_SR address
+     *   r5 - busy mask of FLASH_SR
+     *   r6 - program unit in bytes: 1, 4 or 8
+     *
+     * Returns:
+     *   r0 - expanded size in bytes
+     *   r1 - bytes left to program, 0 on success
+     */
+
+    .global copy
+copy:
+    # r1 - end of compressed data, r7 - write ptr into the staging buffer
+    add r1, r1, r0
+    mov r7, r2
+
+token:
+    # r8 - token: literal count in the high nibble, match length - 4 in the low one
+    ldrb r8, [r0], #1
+    lsr r9, r8, #4
+    bl length
+
+literals:
+    cmp r9, #0
+    beq literals_done
+    ldrb r10, [r0], #1
+    strb r10, [r7], #1
+    subs r9, r9, #1
+    b literals
+
+literals_done:
+    # the last sequence has no match
+    cmp r0, r1
+    bhs program
+
+    # r10 - match source, the offset back from the write ptr is little endian
+    ldrb r10, [r0], #1
+    ldrb r11, [r0], #1
+    orr r10, r10, r11, lsl #8
+    sub r10, r7, r10
+
+    and r9, r8, #15
+    bl length
+    add r9, r9, #4
+
+match:
+    # byte by byte, a match may overlap the data it produces
+    ldrb r11, [r10], #1
+    strb r11, [r7], #1
+    subs r9, r9, #1
+    bne match
+    b token
+
+length:
+    # a nibble of 15 continues in the following bytes until one is not 255,
+    # r11 is free here while r10 holds the match source
+    cmp r9, #15
+    bne length_done
+
+length_more:
+    ldrb r11, [r0], #1
+    add r9, r9, r11
+    cmp r11, #255
+    beq length_more
+
+length_done:
+    bx lr
+
+program:
+    # r0 - expanded size, r1 - bytes left to program, r2 - source
+    sub r0, r7, r2
+    mov r1, r0
+    cmp r1, #0
+    beq exit
+
+loop:
+    cmp r6, #1
+    beq copy_byte
+    cmp r6, #4
+    beq copy_word
+
+    # copy 8 bytes
+    ldr r10, [r2], #4
+    ldr r11, [r2], #4
+    str r10, [r3], #4
+    str r11, [r3], #4
+    b wait
+
+copy_word:
+    # copy 4 bytes
+    ldr r10, [r2], #4
+    str r10, [r3], #4
+    b wait
+
+copy_byte:
+    # copy 1 byte
+    ldrb r10, [r2], #1
+    strb r10, [r3], #1
+
+wait:
+    dsb sy
+
+    # get FLASH_SR
+    ldr r10, [r4]
+
+    # wait until BUSY flag is reset
+    tst r10, r5
+    bne wait
+
+    # loop if count > 0
+    subs r1, r1, r6
+    bgt loop
+
+exit:
+    bkpt
+
+    .align 2
@@ -0,0 +1,87 @@
+    .syntax unified
+    .text
+
+    /*
+     * Double-buffered loader for F2/F4/F7/L4: keeps running while the host
+     * streams the next chunk, handing buffers over through a mailbox word
+     * per buffer instead of stopping at a breakpoint after every chunk.
+     *
+     * Arguments:
+     *   r0 - buffer 0 ptr, buffer 1 follows at r0 + r2
+     *   r1 - target memory ptr
+     *   r2 - size of one buffer in bytes
+     *   r3 - FLASH_SR address
+     *   r4 - busy mask of FLASH_SR
+     *   r5 - mailbox ptr: byte count of buffer 0 at [r5], of buffer 1 at [r5, #4]
+     *   r6 - program unit in bytes: 1, 4 or 8
+     */
+
+    .global copy
+copy:
+    # r7 - offset of the current mailbox word
+    mov r7, #0
+
+mailbox:
+    # wait until the host fills the current buffer
+    ldr r8, [r5, r7]
+    cmp r8, #0
+    beq mailbox
+
+    # 0xffffffff marks the end of data
+    cmn r8, #1
+    beq exit
+
+    # r9 - source, buffer 0 or buffer 1
+    mov r9, r0
+    cbz r7, loop
+    add r9, r9, r2
+
+loop:
+    cmp r6, #1
+    beq copy_byte
+    cmp r6, #4
+    beq copy_word
+
+    # copy 8 bytes
+    ldr r10, [r9], #4
+    ldr r11, [r9], #4
+    str r10, [r1], #4
+    str r11, [r1], #4
+    b wait
+
+copy_word:
+    # copy 4 bytes
+    ldr r10, [r9], #4
+    str r10, [r1], #4
+    b wait
+
+copy_byte:
+    # copy 1 byte
+    ldrb r10, [r9], #1
+    strb r10, [r1], #1
+
+wait:
+    dsb sy
+
+    # get FLASH_SR
+    ldr r10, [r3]
+
+    # wait until BUSY flag is reset
+    tst r10, r4
+    bne wait
+
+    # loop if count > 0
+    subs r8, r8, r6
+    bgt loop
+
+    # give the buffer back to the host and switch to the other one
+    mov r10, #0
+    str r10, [r5, r7]
+    eor r7, r7, #4
+    b mailbox
+
+exit:
+    mov r2, #0
+    bkpt
+
+    .align 2
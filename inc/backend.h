@@ -34,6 +34,9 @@
         int32_t (*trace_enable) (stlink_t * sl, uint32_t frequency);
         int32_t (*trace_disable) (stlink_t * sl);
         int32_t (*trace_read) (stlink_t * sl, uint8_t* buf, uint32_t size);
+        int32_t (*debug32_batch) (stlink_t *sl, stlink_debug32_op_t *ops, uint32_t count);
+        int32_t (*read_mem) (stlink_t *sl, uint32_t addr, uint32_t len, uint8_t *dst);
+        int32_t (*write_mem) (stlink_t *sl, uint32_t addr, uint32_t len, const uint8_t *src);
     } stlink_backend_t;
 
 #endif // BACKEND_H
@@ -72,6 +72,14 @@ enum target_state {
 #define STLINK_V3_MAX_TRACE_FREQUENCY  24000000
 #define STLINK_DEFAULT_TRACE_FREQUENCY  2000000
 
+/* Memory transfer limits, see stlink_xfer_caps_t */
+#define STLINK_V2_MAX_RW8                  64
+#define STLINK_V3_MAX_RW8                 512
+#define STLINK_V2_RW32_CMD_SIZE          1024
+#define STLINK_V3_RW32_CMD_SIZE        0x1800
+#define STLINK_BLOCK_SIZE_SYNC         0x1800   // anything larger stalls an ST-LINK/V2
+#define STLINK_BLOCK_SIZE_PIPELINED    0xC000   // fits the uint16_t length of stlink_read_mem32()
+
 /* Map the relevant features, quirks and workaround for specific firmware version of stlink */
 #define STLINK_F_HAS_TRACE              (1 << 0)
 #define STLINK_F_HAS_SWD_SET_FREQ       (1 << 1)
@@ -124,6 +132,53 @@ struct stlink_reg {
 
 typedef uint32_t stm32_addr_t;
 
+/* Transfer capabilities of the connected ST-LINK, filled in by _parse_version() and the backend */
+typedef struct stlink_xfer_caps {
+    uint32_t max_rw8;       // largest READMEM_8BIT/WRITEMEM_8BIT transfer
+    uint32_t rw32_cmd_size; // largest single READMEM_32BIT/WRITEMEM_32BIT command
+    uint32_t block_size;    // largest block to hand to one stlink_read_mem32()/stlink_write_mem32() call
+} stlink_xfer_caps_t;
+
+/* One contiguous block of an image, see stlink_parse_ihex_segments(), stlink_parse_elf_segments()
+ * and stlink_parse_manifest_segments() */
+typedef struct stlink_segment {
+    stm32_addr_t addr;
+    uint32_t len;
+    uint8_t *data;
+} stlink_segment_t;
+
+/* Operations timed by the flash busy polling, see flash_poll.c */
+enum stlink_poll_op {
+    STLINK_POLL_OTHER = 0,      // any other wait for the flash, not modelled
+    STLINK_POLL_PAGE_ERASE,
+    STLINK_POLL_SECTOR_ERASE,
+    STLINK_POLL_PROGRAM,
+    STLINK_POLL_LOADER,         // one flash loader run or mailbox buffer
+    STLINK_POLL_CRC,            // one crc32 routine run
+    STLINK_POLL_OPS
+};
+
+#define STLINK_POLL_HIST_BUCKETS 16
+
+typedef struct stlink_poll_stats {
+    uint32_t count;
+    uint32_t us_per_kb;         // learned duration per KiB of data
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t hist[STLINK_POLL_HIST_BUCKETS]; // bucket n counts durations below 64 << n us, the last one the rest
+} stlink_poll_stats_t;
+
+/* Queued debug register access, see stlink_debug32_begin() */
+#define STLINK_DEBUG32_QUEUE_LEN 32
+
+typedef struct stlink_debug32_op {
+    uint32_t addr;
+    uint32_t data;      // value to write
+    uint32_t *result;   // where to store the value read, NULL for a write
+    int32_t *error;     // optional, set to 0 on success or -1 on failure of this access
+    int32_t status;     // set by the backend
+} stlink_debug32_op_t;
+
 typedef struct flash_loader {
     stm32_addr_t loader_addr; // loader sram addr
     stm32_addr_t buf_addr; // buffer sram address
@@ -202,6 +257,8 @@ struct _stlink {
     int32_t opt;
     uint32_t core_id;               // set by stlink_core_id(), result from STLINK_DEBUGREADCOREID
     uint32_t chip_id;               // set by stlink_load_device_params(), used to identify flash and sram
+    stm32_addr_t idcode_addr;       // set by stlink_chip_id(), address of DBGMCU_IDCODE
+    uint32_t idcode;                // set by stlink_chip_id(), raw DBGMCU_IDCODE, validates the parameter cache
     enum target_state core_stat;    // set by stlink_status()
 
     char serial[STLINK_SERIAL_BUFFER_SIZE];
@@ -233,9 +290,18 @@ struct _stlink {
     uint32_t chip_flags;            // stlink_chipid_params.flags, set by stlink_load_device_params(), values: CHIP_F_xxx
 
     uint32_t max_trace_freq;        // set by stlink_open_usb()
+    stlink_xfer_caps_t xfer_caps;   // set by stlink_open_usb()
+    stlink_poll_stats_t poll_stats[STLINK_POLL_OPS]; // updated by stlink_poll_wait()
+    bool flash_mass_erased;         // set by stlink_erase_flash_mass(), enables fast programming
+    bool flash_blank_check;         // skip erasing pages that are already blank
+    bool flash_compress;            // send compressed data to the LZ4 loader (F2/F4/F7/L4)
 
     uint32_t otp_base;
     uint32_t otp_size;
+
+    // debug register accesses queued by stlink_debug32_queue_*()
+    stlink_debug32_op_t debug32_queue[STLINK_DEBUG32_QUEUE_LEN];
+    uint32_t debug32_queue_len;
 };
 
 /* Functions defined in common.c */
@@ -256,8 +322,15 @@ int32_t stlink_force_debug(stlink_t *sl);
 int32_t stlink_target_voltage(stlink_t *sl);
 int32_t stlink_set_swdclk(stlink_t *sl, int32_t freq_khz);
 int32_t stlink_parse_ihex(const char* path, uint8_t erased_pattern, uint8_t* *mem, uint32_t* size, uint32_t* begin);
+int32_t stlink_parse_ihex_segments(const char *path, stlink_segment_t **segs, uint32_t *count);
+int32_t stlink_parse_elf_segments(const char *path, stlink_segment_t **segs, uint32_t *count);
+int32_t stlink_parse_manifest_segments(const char *path, stlink_segment_t **segs, uint32_t *count);
+int32_t stlink_segments_flatten(const stlink_segment_t *segs, uint32_t count, uint8_t fill,
+                                uint8_t **mem, uint32_t *size, uint32_t *begin);
+void stlink_free_segments(stlink_segment_t *segs, uint32_t count);
 uint8_t stlink_get_erased_pattern(stlink_t *sl);
 int32_t stlink_mwrite_sram(stlink_t *sl, uint8_t* data, uint32_t length, stm32_addr_t addr);
+int32_t stlink_write_sram_segments(stlink_t *sl, const stlink_segment_t *segs, uint32_t count);
 int32_t stlink_fwrite_sram(stlink_t *sl, const char* path, stm32_addr_t addr);
 int32_t stlink_cpu_id(stlink_t *sl, cortex_m3_cpuid_t *cpuid);
 uint32_t stlink_calculate_pagesize(stlink_t *sl, uint32_t flashaddr);
@@ -346,6 +346,7 @@
 #define FLASH_L4_CR_MER1 2          /* Bank 1 erase */
 #define FLASH_L4_CR_MER2 15         /* Bank 2 erase */
 #define FLASH_L4_CR_STRT 16         /* Start command */
+#define FLASH_L4_CR_FSTPG 18        /* Fast programming */
 #define FLASH_L4_CR_OPTSTRT 17      /* Start writing option bytes */
 #define FLASH_L4_CR_BKER 11         /* Bank select for page erase */
 #define FLASH_L4_CR_PNB 3           /* Page number (8 bits) */
@@ -0,0 +1,554 @@
+/*
+ * File: bench.c
+ *
+ * Tool st-bench: latency and throughput of the transport and flash paths
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stlink.h>
+#include "bench.h"
+
+#include <chipid.h>
+#include <common_flash.h>
+#include <flash_loader.h>
+#include <helper.h>
+#include <logging.h>
+#include <read_write.h>
+#include <register.h>
+#include <usb.h>
+
+#define DEFAULT_LOGGING_LEVEL 50
+#define DEBUG_LOGGING_LEVEL 100
+#define DEFAULT_ITERATIONS 1000
+
+#define APP_RESULT_SUCCESS 0
+#define APP_RESULT_INVALID_PARAMS 1
+#define APP_RESULT_STLINK_NOT_FOUND 2
+#define APP_RESULT_STLINK_MISSING_DEVICE 3
+#define APP_RESULT_BENCH_FAILED 4
+
+#define BENCH_MEM_BYTES 0x2000      // data moved per chunk size
+#define BENCH_MEM_MIN_REPS 16       // transfers per chunk size at least
+#define BENCH_FLASH_MAX 0x10000     // largest area written by the flash benchmarks
+
+// SWD clocks of the sweep, the probe picks the nearest one it supports
+static const int32_t sweep_khz[] = {24000, 8000, 4000, 1800, 950, 480, 240, 100};
+
+// indexed by enum stm32_flash_type, names as in the chip files
+static const char *const flash_type_names[] = {
+  "unknown", "C0", "F0_F1_F3", "F1_XL", "F2_F4", "F7", "G0",
+  "G4", "H7", "L0_L1", "L4", "L5_U5_H5", "WB_WL",
+};
+
+static void usage(void) {
+  puts("st-bench - usage:");
+  puts("  -h, --help            Print this help");
+  puts("  -V, --version         Print this version");
+  puts("  -vXX, --verbose=XX    Specify a specific verbosity level (0..99)");
+  puts("  -v, --verbose         Specify a generally verbose logging");
+  puts("  -sXX, --serial=XX     Use a specific serial number");
+  puts("  --freq=XX             SWD frequency in kHz, optionally followed by M=MHz");
+  puts("  --connect-under-reset Connect while the target is held in reset");
+  puts("  --hot-plug            Connect without resetting the target");
+  puts("  -nXX, --iterations=XX Debug register round trips per measurement");
+  puts("  --no-sweep            Skip the SWD clock sweep");
+  puts("  --flash=ADDR          Also benchmark erase, flash loader and verify on the");
+  puts("                        page starting at ADDR. The page is erased afterwards");
+  puts("  -oXX, --output=XX     Write the JSON report to a file instead of stdout");
+}
+
+static bool parse_options(int32_t argc, char **argv, st_bench_settings_t *settings) {
+
+  static struct option long_options[] = {
+      {"help", no_argument, NULL, 'h'},
+      {"version", no_argument, NULL, 'V'},
+      {"verbose", optional_argument, NULL, 'v'},
+      {"serial", required_argument, NULL, 's'},
+      {"freq", required_argument, NULL, 'F'},
+      {"connect-under-reset", no_argument, NULL, 'R'},
+      {"hot-plug", no_argument, NULL, 'H'},
+      {"iterations", required_argument, NULL, 'n'},
+      {"no-sweep", no_argument, NULL, 'N'},
+      {"flash", required_argument, NULL, 'f'},
+      {"output", required_argument, NULL, 'o'},
+      {0, 0, 0, 0},
+  };
+  int32_t option_index = 0;
+  int32_t c;
+  char *tail;
+  bool error = false;
+
+  memset(settings, 0, sizeof(*settings));
+  settings->logging_level = DEFAULT_LOGGING_LEVEL;
+  settings->connect = CONNECT_NORMAL;
+  settings->iterations = DEFAULT_ITERATIONS;
+  settings->sweep = true;
+  ugly_init(settings->logging_level);
+
+  while ((c = getopt_long(argc, argv, "hVv::s:n:o:", long_options, &option_index)) != -1) {
+    switch (c) {
+    case 'h':
+      settings->show_help = true;
+      break;
+    case 'V':
+      settings->show_version = true;
+      break;
+    case 'v':
+      if (optarg) {
+        settings->logging_level = atoi(optarg);
+      } else {
+        settings->logging_level = DEBUG_LOGGING_LEVEL;
+      }
+      ugly_init(settings->logging_level);
+      break;
+    case 's':
+      settings->serial_number = optarg;
+      break;
+    case 'F':
+      settings->freq = arg_parse_freq(optarg);
+      if (settings->freq < 0) {
+        ELOG("Invalid frequency: '%s'\n", optarg);
+        error = true;
+      }
+      break;
+    case 'R':
+      settings->connect = CONNECT_UNDER_RESET;
+      break;
+    case 'H':
+      settings->connect = CONNECT_HOT_PLUG;
+      break;
+    case 'n':
+      settings->iterations = (uint32_t) strtoul(optarg, &tail, 0);
+      if (*tail != '\0' || settings->iterations == 0) {
+        ELOG("Invalid iteration count: '%s'\n", optarg);
+        error = true;
+      }
+      break;
+    case 'N':
+      settings->sweep = false;
+      break;
+    case 'f':
+      settings->flash = true;
+      settings->flash_addr = (stm32_addr_t) strtoul(optarg, &tail, 0);
+      if (*tail != '\0') {
+        ELOG("Invalid flash address: '%s'\n", optarg);
+        error = true;
+      }
+      break;
+    case 'o':
+      settings->output = optarg;
+      break;
+    case '?':
+      error = true;
+      break;
+    default:
+      ELOG("Unknown command line option: '%c' (0x%02x)\n", c, c);
+      error = true;
+      break;
+    }
+  }
+
+  if (optind < argc) {
+    while (optind < argc) {
+      ELOG("Unknown command line argument: '%s'\n", argv[optind++]);
+    }
+    error = true;
+  }
+
+  return (!error);
+}
+
+/*
+ * Minimal JSON writer, one member per line. A member is introduced by
+ * json_key(), which also emits the separator to the previous member.
+ */
+
+static void json_key(json_writer_t *j, const char *key) {
+  if (j->depth > 0) {
+    fprintf(j->file, "%s\n%*s", j->first[j->depth] ? "" : ",", (int) (2 * j->depth), "");
+  }
+
+  if (key != NULL) { fprintf(j->file, "\"%s\": ", key); }
+
+  j->first[j->depth] = false;
+}
+
+static void json_begin(json_writer_t *j, const char *key, char open) {
+  json_key(j, key);
+  fputc(open, j->file);
+  j->first[++j->depth] = true;
+}
+
+static void json_end(json_writer_t *j, char close) {
+  bool empty = j->first[j->depth--];
+
+  if (!empty) { fprintf(j->file, "\n%*s", (int) (2 * j->depth), ""); }
+
+  fputc(close, j->file);
+}
+
+static void json_uint(json_writer_t *j, const char *key, uint64_t value) {
+  json_key(j, key);
+  fprintf(j->file, "%llu", (unsigned long long) value);
+}
+
+static void json_string(json_writer_t *j, const char *key, const char *value) {
+  json_key(j, key);
+  fputc('"', j->file);
+
+  for (; *value; value++) {
+    if (*value == '"' || *value == '\\') {
+      fprintf(j->file, "\\%c", *value);
+    } else if ((unsigned char) *value < 0x20) {
+      fprintf(j->file, "\\u%04x", (unsigned char) *value);
+    } else {
+      fputc(*value, j->file);
+    }
+  }
+
+  fputc('"', j->file);
+}
+
+static void latency_add(bench_latency_t *lat, int32_t ret, uint32_t us) {
+  if (ret) {
+    lat->errors++;
+    return;
+  }
+
+  if (lat->count == 0 || us < lat->min_us) { lat->min_us = us; }
+  if (us > lat->max_us) { lat->max_us = us; }
+
+  lat->count++;
+  lat->total_us += us;
+}
+
+static void json_latency(json_writer_t *j, const char *key, const bench_latency_t *lat) {
+  json_begin(j, key, '{');
+  json_uint(j, "count", lat->count);
+  json_uint(j, "errors", lat->errors);
+  json_uint(j, "min_us", lat->min_us);
+  json_uint(j, "avg_us", lat->count ? lat->total_us / lat->count : 0);
+  json_uint(j, "max_us", lat->max_us);
+  json_end(j, '}');
+}
+
+static uint64_t bench_rate(uint64_t bytes, uint32_t us) {
+  return (us ? bytes * 1000000 / us : 0);
+}
+
+// round trips of single debug register accesses
+static void bench_debug32(stlink_t *sl, json_writer_t *j, uint32_t iterations) {
+  bench_latency_t rd = { 0 }, wr = { 0 };
+  uint32_t t0, data;
+  int32_t ret;
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    t0 = time_us();
+    ret = stlink_read_debug32(sl, STLINK_REG_DHCSR, &data);
+    latency_add(&rd, ret, time_us() - t0);
+  }
+
+  // DCRDR is a scratch register while the core is halted
+  for (uint32_t i = 0; i < iterations; i++) {
+    t0 = time_us();
+    ret = stlink_write_debug32(sl, STLINK_REG_DCRDR, i);
+    latency_add(&wr, ret, time_us() - t0);
+  }
+
+  json_begin(j, "debug32", '{');
+  json_latency(j, "read", &rd);
+  json_latency(j, "write", &wr);
+  json_end(j, '}');
+}
+
+// moves reps blocks of size bytes through the start of SRAM
+static void bench_mem32(stlink_t *sl, json_writer_t *j, const char *key, uint32_t size, uint32_t reps) {
+  uint32_t write_us, read_us, t0, errors = 0;
+
+  for (uint32_t i = 0; i < size; i++) { sl->q_buf[i] = (uint8_t) (i * 7 + size); }
+
+  t0 = time_us();
+  for (uint32_t r = 0; r < reps; r++) {
+    if (stlink_write_mem32(sl, sl->sram_base, (uint16_t) size)) { errors++; }
+  }
+  write_us = time_us() - t0;
+
+  t0 = time_us();
+  for (uint32_t r = 0; r < reps; r++) {
+    if (stlink_read_mem32(sl, sl->sram_base, (uint16_t) size)) { errors++; }
+  }
+  read_us = time_us() - t0;
+
+  // the last read must return what was written
+  for (uint32_t i = 0; i < size; i++) {
+    if (sl->q_buf[i] != (uint8_t) (i * 7 + size)) {
+      errors++;
+      break;
+    }
+  }
+
+  json_begin(j, key, '{');
+  json_uint(j, "chunk", size);
+  json_uint(j, "bytes", (uint64_t) size * reps);
+  json_uint(j, "write_us", write_us);
+  json_uint(j, "write_bytes_per_s", bench_rate((uint64_t) size * reps, write_us));
+  json_uint(j, "read_us", read_us);
+  json_uint(j, "read_bytes_per_s", bench_rate((uint64_t) size * reps, read_us));
+  json_uint(j, "errors", errors);
+  json_end(j, '}');
+}
+
+static uint32_t bench_max_chunk(stlink_t *sl) {
+  uint32_t max = sl->xfer_caps.block_size;
+
+  if (max > sl->sram_size) { max = sl->sram_size; }
+
+  return (max & ~3u);
+}
+
+// mem32 throughput for every chunk size from a word up to the largest block
+static void bench_transfer(stlink_t *sl, json_writer_t *j) {
+  uint32_t max = bench_max_chunk(sl);
+
+  json_begin(j, "mem32", '[');
+
+  for (uint32_t size = 4; size <= max; size = (size * 2 < max) ? size * 2 : max) {
+    uint32_t reps = BENCH_MEM_BYTES / size;
+
+    bench_mem32(sl, j, NULL, size, (reps < BENCH_MEM_MIN_REPS) ? BENCH_MEM_MIN_REPS : reps);
+
+    if (size == max) { break; }
+  }
+
+  json_end(j, ']');
+}
+
+static void bench_sweep(stlink_t *sl, json_writer_t *j, const st_bench_settings_t *settings) {
+  uint32_t max = bench_max_chunk(sl);
+  uint32_t iterations = (settings->iterations < 100) ? settings->iterations : 100;
+
+  json_begin(j, "swd_sweep", '[');
+
+  for (uint32_t n = 0; n < STLINK_ARRAY_SIZE(sweep_khz); n++) {
+    bench_latency_t rd = { 0 };
+    uint32_t t0, data;
+    int32_t ret;
+
+    json_begin(j, NULL, '{');
+    json_uint(j, "requested_khz", sweep_khz[n]);
+
+    if (stlink_set_swdclk(sl, sweep_khz[n])) {
+      json_string(j, "status", "unsupported");
+      json_end(j, '}');
+      continue;
+    }
+
+    for (uint32_t i = 0; i < iterations; i++) {
+      t0 = time_us();
+      ret = stlink_read_debug32(sl, STLINK_REG_DHCSR, &data);
+      latency_add(&rd, ret, time_us() - t0);
+    }
+
+    json_string(j, "status", rd.errors ? "errors" : "ok");
+    json_latency(j, "read_debug32", &rd);
+    bench_mem32(sl, j, "mem32", max, BENCH_MEM_MIN_REPS);
+    json_end(j, '}');
+  }
+
+  json_end(j, ']');
+
+  // back to the clock of the other benchmarks
+  stlink_set_swdclk(sl, settings->freq);
+}
+
+// erase, program through the flash loader and verify one page
+static int32_t bench_flash(stlink_t *sl, json_writer_t *j, stm32_addr_t addr) {
+  flash_loader_t fl;
+  uint32_t page_size, len, t0, erase_us, program_us, verify_us;
+  uint8_t *data = NULL;
+  int32_t ret = -1;
+
+  if (addr < sl->flash_base || addr >= sl->flash_base + sl->flash_size) {
+    ELOG("Address %#x is outside of the flash memory\n", addr);
+    goto out;
+  }
+
+  // only the page at addr is erased, the data must not run into the next one
+  if (stlink_check_address_alignment(sl, addr)) {
+    ELOG("Address %#x is not the start of a flash page\n", addr);
+    goto out;
+  }
+
+  page_size = stlink_calculate_pagesize(sl, addr);
+  len = page_size;
+  if (len > BENCH_FLASH_MAX) { len = BENCH_FLASH_MAX; }
+  if (len > sl->flash_base + sl->flash_size - addr) { len = sl->flash_base + sl->flash_size - addr; }
+
+  // random data keeps the loader from profiting from erased bytes
+  data = malloc(len);
+  if (data == NULL) {
+    ELOG("Could not allocate %u bytes\n", len);
+    goto out;
+  }
+
+  srand(len);
+  for (uint32_t i = 0; i < len; i++) { data[i] = (uint8_t) rand(); }
+
+  t0 = time_us();
+  if (stlink_erase_flash_page(sl, addr)) {
+    ELOG("Failed to erase the page at %#x\n", addr);
+    goto out;
+  }
+  erase_us = time_us() - t0;
+
+  if (stlink_flashloader_start(sl, &fl)) {
+    ELOG("stlink_flashloader_start() == -1\n");
+    goto erase;
+  }
+
+  t0 = time_us();
+  ret = stlink_flashloader_write(sl, &fl, addr, data, len);
+  program_us = time_us() - t0;
+
+  if (stlink_flashloader_stop(sl, &fl) || ret) {
+    ELOG("Failed to program %u bytes at %#x\n", len, addr);
+    ret = -1;
+    goto erase;
+  }
+
+  t0 = time_us();
+  ret = stlink_verify_write_flash(sl, addr, data, len);
+  verify_us = time_us() - t0;
+
+  if (ret) {
+    ELOG("Verification of %u bytes at %#x failed\n", len, addr);
+    goto erase;
+  }
+
+  json_begin(j, "flash", '{');
+  json_string(j, "status", "ok");
+  json_string(j, "flash_type", flash_type_names[sl->flash_type]);
+  json_uint(j, "address", addr);
+  json_uint(j, "page_size", page_size);
+  json_uint(j, "bytes", len);
+  json_uint(j, "erase_us", erase_us);
+  json_uint(j, "program_us", program_us);
+  json_uint(j, "program_bytes_per_s", bench_rate(len, program_us));
+  json_uint(j, "verify_us", verify_us);
+  json_uint(j, "verify_bytes_per_s", bench_rate(len, verify_us));
+  json_end(j, '}');
+
+erase:
+  // leave the page erased
+  stlink_erase_flash_page(sl, addr);
+
+out:
+  if (ret) {
+    json_begin(j, "flash", '{');
+    json_string(j, "status", "error");
+    json_end(j, '}');
+  }
+
+  free(data);
+  return (ret);
+}
+
+int32_t main(int32_t argc, char **argv) {
+  st_bench_settings_t settings;
+  json_writer_t j = { 0 };
+  const struct stlink_chipid_params *params;
+  int32_t result = APP_RESULT_SUCCESS;
+  int32_t voltage;
+  stlink_t *sl;
+
+  if (!parse_options(argc, argv, &settings)) {
+    usage();
+    return APP_RESULT_INVALID_PARAMS;
+  }
+
+  if (settings.show_help) {
+    usage();
+    return APP_RESULT_SUCCESS;
+  }
+
+  if (settings.show_version) {
+    printf("v%s\n", STLINK_VERSION);
+    return APP_RESULT_SUCCESS;
+  }
+
+  init_chipids(STLINK_CHIPS_DIR);
+
+  sl = stlink_open_usb(settings.logging_level, settings.connect, settings.serial_number, settings.freq);
+  if (!sl) {
+    ELOG("Unable to locate an stlink\n");
+    return APP_RESULT_STLINK_NOT_FOUND;
+  }
+
+  if (sl->chip_id == STM32_CHIPID_UNKNOWN) {
+    ELOG("Your stlink is not connected to a device\n");
+    stlink_close(sl);
+    return APP_RESULT_STLINK_MISSING_DEVICE;
+  }
+
+  j.file = stdout;
+  if (settings.output != NULL && (j.file = fopen(settings.output, "w")) == NULL) {
+    ELOG("Could not open %s\n", settings.output);
+    stlink_close(sl);
+    return APP_RESULT_INVALID_PARAMS;
+  }
+
+  // the benchmarks overwrite SRAM, the core must not run meanwhile
+  stlink_force_debug(sl);
+
+  params = stlink_chipid_get_params(sl->chip_id);
+  voltage = stlink_target_voltage(sl);
+
+  json_begin(&j, NULL, '{');
+  json_string(&j, "version", STLINK_VERSION);
+
+  json_begin(&j, "probe", '{');
+  json_string(&j, "serial", sl->serial);
+  json_uint(&j, "stlink_v", sl->version.stlink_v);
+  json_uint(&j, "jtag_v", sl->version.jtag_v);
+  json_uint(&j, "swim_v", sl->version.swim_v);
+  json_uint(&j, "freq_khz", settings.freq);
+  json_uint(&j, "block_size", sl->xfer_caps.block_size);
+  if (voltage >= 0) { json_uint(&j, "target_voltage_mv", voltage); }
+  json_end(&j, '}');
+
+  json_begin(&j, "target", '{');
+  json_uint(&j, "chip_id", sl->chip_id);
+  json_string(&j, "dev_type", params ? params->dev_type : "unknown");
+  json_string(&j, "flash_type", flash_type_names[sl->flash_type]);
+  json_uint(&j, "flash_size", sl->flash_size);
+  json_uint(&j, "flash_page_size", sl->flash_pgsz);
+  json_uint(&j, "sram_size", sl->sram_size);
+  json_end(&j, '}');
+
+  bench_debug32(sl, &j, settings.iterations);
+  bench_transfer(sl, &j);
+
+  if (settings.sweep) { bench_sweep(sl, &j, &settings); }
+
+  if (settings.flash && bench_flash(sl, &j, settings.flash_addr)) {
+    result = APP_RESULT_BENCH_FAILED;
+  }
+
+  json_end(&j, '}');
+  fputc('\n', j.file);
+
+  if (j.file != stdout) { fclose(j.file); }
+
+  // SRAM contents are gone, restart the application from reset
+  stlink_reset(sl, RESET_AUTO);
+  stlink_exit_debug_mode(sl);
+  stlink_close(sl);
+
+  return (result);
+}
@@ -0,0 +1,56 @@
+/*
+ * File: bench.h
+ *
+ * Tool st-bench
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+typedef struct {
+  bool show_help;
+  bool show_version;
+  int32_t logging_level;
+  enum connect_type connect;
+  int32_t freq;               // kHz, 0 selects the probe default
+  uint32_t iterations;        // debug32 round trips per measurement
+  bool sweep;                 // run the SWD clock sweep
+  bool flash;                 // run the flash benchmarks (destructive)
+  stm32_addr_t flash_addr;    // page erased and written by the flash benchmarks
+  char *serial_number;
+  char *output;               // JSON report file, stdout if NULL
+} st_bench_settings_t;
+
+typedef struct {
+  FILE *file;
+  uint32_t depth;
+  bool first[8];              // no member written yet at this depth
+} json_writer_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t errors;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+} bench_latency_t;
+
+static void usage(void);
+static bool parse_options(int32_t argc, char **argv, st_bench_settings_t *settings);
+static void json_key(json_writer_t *j, const char *key);
+static void json_begin(json_writer_t *j, const char *key, char open);
+static void json_end(json_writer_t *j, char close);
+static void json_uint(json_writer_t *j, const char *key, uint64_t value);
+static void json_string(json_writer_t *j, const char *key, const char *value);
+static void latency_add(bench_latency_t *lat, int32_t ret, uint32_t us);
+static void json_latency(json_writer_t *j, const char *key, const bench_latency_t *lat);
+static uint64_t bench_rate(uint64_t bytes, uint32_t us);
+static void bench_debug32(stlink_t *sl, json_writer_t *j, uint32_t iterations);
+static void bench_mem32(stlink_t *sl, json_writer_t *j, const char *key, uint32_t size, uint32_t reps);
+static uint32_t bench_max_chunk(stlink_t *sl);
+static void bench_transfer(stlink_t *sl, json_writer_t *j);
+static void bench_sweep(stlink_t *sl, json_writer_t *j, const st_bench_settings_t *settings);
+static int32_t bench_flash(stlink_t *sl, json_writer_t *j, stm32_addr_t addr);
+int32_t main(int32_t argc, char **argv);
+
+#endif // BENCH_H
@@ -25,6 +25,8 @@
 
 #include <chipid.h>
 #include <common_flash.h>
+#include <flash_poll.h>
+#include <gang.h>
 #include <map_file.h>
 #include <option_bytes.h>
 #include <usb.h>
@@ -56,12 +58,19 @@ static void usage(void) {
     puts("  --connect-under-reset  Pull reset low while connecting.");
     puts("  --hot-plug             Connect without reset.");
     puts("  --reset                Reset after writing.");
-    puts("  --format {binary|ihex} Format of file to read or write. When writing");
-    puts("                         with ihex specifying addr is not needed.");
+    puts("  --format {binary|ihex|elf|manifest}");
+    puts("                         Format of file to read or write. When writing");
+    puts("                         with ihex or elf specifying addr is not needed.");
+    puts("                         elf can only be written. A manifest lists");
+    puts("                         several images to write in one session.");
     puts("  --flash <size>         Specify size of flash, e.g. 128k, 1M.");
     puts("  --area <area>          Area to access, one of: main(default), system,");
     puts("                         otp, option, option_boot_add, optcr, optcr1.");
     puts("  --opt                  Skip writing empty bytes at the tail end.");
+    puts("  --delta                Erase and write only the pages that differ.");
+    puts("  --blank-check          Do not erase pages that are already blank.");
+    puts("  --compress             Send compressed data to the flash loader.");
+    puts("  --gang                 Write to all connected ST-Links at once.");
     puts("  --debug                Output extra debug information.");
     puts("  --version              Print version information.");
     puts("  --help                 Show this help.");
@@ -79,11 +88,126 @@ static void usage(void) {
     puts("  st-flash --area=otp write <file> 0xXXXXXXXX");
 }
 
+static int32_t parse_segments(const struct flash_opts *o, stlink_segment_t **segs, uint32_t *nsegs) {
+    const char *kind = "Intel-HEX";
+    int32_t err;
+
+    if (o->format == FLASH_FORMAT_ELF) {
+        kind = "ELF";
+        err = stlink_parse_elf_segments(o->filename, segs, nsegs);
+    } else if (o->format == FLASH_FORMAT_MANIFEST) {
+        kind = "manifest";
+        err = stlink_parse_manifest_segments(o->filename, segs, nsegs);
+    } else {
+        err = stlink_parse_ihex_segments(o->filename, segs, nsegs);
+    }
+
+    if (err == -1) { printf("Cannot parse %s as %s file\n", o->filename, kind); }
+
+    return (err);
+}
+
+// image and settings shared read only by all probes of a gang
+struct gang_image {
+    const struct flash_opts *o;
+    const stlink_segment_t *segs;
+    uint32_t nsegs;
+    enum erase_type_t erase_type;
+};
+
+static int32_t gang_write(stlink_t *sl, void *arg) {
+    const struct gang_image *img = arg;
+    const struct flash_opts *o = img->o;
+
+    if (o->flash_size != 0u) { sl->flash_size = o->flash_size; }
+
+    sl->verbose = o->log_level;
+    sl->flash_blank_check = o->blank_check;
+    sl->flash_compress = o->compress;
+
+    if (img->erase_type == MASS_ERASE && stlink_erase_flash_mass(sl) == -1) {
+        ELOG("stlink_erase_flash_mass() == -1\n");
+        return (-1);
+    }
+
+    if (stlink_write_flash_segments(sl, img->segs, img->nsegs, img->erase_type) == -1) {
+        ELOG("stlink_write_flash_segments() == -1\n");
+        return (-1);
+    }
+
+    if (o->reset) { stlink_reset(sl, RESET_AUTO); }
+
+    stlink_run(sl, RUN_NORMAL);
+    return (0);
+}
+
+// write the same image to every connected probe, one thread per probe
+static int32_t gang_main(const struct flash_opts *o) {
+    char (*serials)[STLINK_SERIAL_BUFFER_SIZE] = NULL;
+    stlink_gang_result_t *results = NULL;
+    mapped_file_t mf = MAPPED_FILE_INITIALIZER;
+    stlink_segment_t bin, *segs = NULL;
+    uint32_t nsegs = 0, count = 0;
+    struct gang_image img;
+    int32_t failed = -1;
+
+    ugly_init(o->log_level);
+    img.o = o;
+    img.erase_type = o->mass_erase ? MASS_ERASE : (o->delta ? DELTA_ERASE : SECTION_ERASE);
+
+    // the image is loaded once, the probes only read it
+    if (o->format == FLASH_FORMAT_BINARY) {
+        if (map_file(&mf, o->filename) == -1) {
+            printf("map_file() == -1\n");
+            return (-1);
+        }
+
+        bin.addr = o->addr;
+        bin.len = mf.len;
+        bin.data = mf.base;
+        img.segs = &bin;
+        img.nsegs = 1;
+    } else if (parse_segments(o, &segs, &nsegs) == 0) {
+        img.segs = segs;
+        img.nsegs = nsegs;
+    } else {
+        return (-1);
+    }
+
+    count = stlink_probe_usb_serials(&serials);
+    results = (count != 0) ? calloc(count, sizeof(*results)) : NULL;
+
+    if (results == NULL) {
+        printf("No ST-Link found\n");
+    } else {
+        for (uint32_t i = 0; i < count; i++) { memcpy(results[i].serial, serials[i], STLINK_SERIAL_BUFFER_SIZE); }
+
+        printf("Writing %s with %u probes\n", o->filename, count);
+        failed = stlink_gang_run(results, count, o->log_level, o->connect, o->freq, gang_write, &img);
+
+        for (uint32_t i = 0; i < count; i++) {
+            printf("%s  chip %#05x  %-6s  %u ms\n", results[i].serial, results[i].chip_id,
+                   (results[i].err == 0) ? "OK" : "FAILED", results[i].elapsed_ms);
+        }
+
+        if (failed >= 0) { printf("%u of %u probes succeeded\n", count - (uint32_t) failed, count); }
+    }
+
+    free(results);
+    free(serials);
+    if (mf.base != NULL) { unmap_file(&mf); }
+
+    stlink_free_segments(segs, nsegs);
+
+    return ((failed == 0) ? 0 : -1);
+}
+
 int32_t main(int32_t ac, char** av) {
     stlink_t* sl = NULL;
     struct flash_opts o;
     int32_t err = -1;
-    uint8_t * mem = NULL;
+    stlink_segment_t * segs = NULL;
+    uint32_t nsegs = 0;
     int32_t getopt_ret;
 
     o.size = 0;
@@ -102,6 +226,8 @@ int32_t main(int32_t ac, char** av) {
     printf("st-flash %s\n", STLINK_VERSION);
     init_chipids (STLINK_CHIPS_DIR);
 
+    if (o.gang) { return (gang_main(&o)); }
+
     sl = stlink_open_usb(o.log_level, o.connect, (char *)o.serial, o.freq);
 
     if (sl == NULL) { return (-1); }
@@ -119,7 +245,9 @@ int32_t main(int32_t ac, char** av) {
 
     sl->verbose = o.log_level;
     sl->opt = o.opt;
-    const enum erase_type_t erase_type = o.mass_erase ? MASS_ERASE : SECTION_ERASE;
+    sl->flash_blank_check = o.blank_check;
+    sl->flash_compress = o.compress;
+    const enum erase_type_t erase_type = o.mass_erase ? MASS_ERASE : (o.delta ? DELTA_ERASE : SECTION_ERASE);
 
     connected_stlink = sl;
     signal(SIGINT, &cleanup);
@@ -138,8 +266,6 @@ int32_t main(int32_t ac, char** av) {
     }
 
     if (o.cmd == FLASH_CMD_WRITE) {
-        uint32_t size = 0;
-
         if (erase_type == MASS_ERASE) {
             err = stlink_erase_flash_mass(sl);
             if (err == -1) {
@@ -149,17 +275,24 @@ int32_t main(int32_t ac, char** av) {
         }
 
         // write
-        if (o.format == FLASH_FORMAT_IHEX) {
-            err = stlink_parse_ihex(o.filename, stlink_get_erased_pattern(sl), &mem, &size, &o.addr);
+        bool use_segs = (o.format == FLASH_FORMAT_IHEX || o.format == FLASH_FORMAT_ELF ||
+                         o.format == FLASH_FORMAT_MANIFEST);
 
-            if (err == -1) {
-                printf("Cannot parse %s as Intel-HEX file\n", o.filename);
-                goto on_error;
+        if (use_segs) {
+            err = parse_segments(&o, &segs, &nsegs);
+
+            if (err == -1) { goto on_error; }
+
+            // the lowest address selects the memory area
+            o.addr = segs[0].addr;
+            for (uint32_t i = 1; i < nsegs; i++) {
+                if (segs[i].addr < o.addr) { o.addr = segs[i].addr; }
             }
         }
         if ((o.addr >= sl->flash_base) && (o.addr < sl->flash_base + sl->flash_size)) {
-            if (o.format == FLASH_FORMAT_IHEX) {
-                err = stlink_mwrite_flash(sl, mem, size, o.addr, erase_type);
+            if (use_segs) {
+                // program only the pages covered by the segments
+                err = stlink_write_flash_segments(sl, segs, nsegs, erase_type);
             } else {
                 err = stlink_fwrite_flash(sl, o.filename, o.addr, erase_type);
             }
@@ -169,8 +302,8 @@ int32_t main(int32_t ac, char** av) {
                 goto on_error;
             }
         } else if ((o.addr >= sl->sram_base) && (o.addr < sl->sram_base + sl->sram_size)) {
-            if (o.format == FLASH_FORMAT_IHEX) {
-                err = stlink_mwrite_sram(sl, mem, size, o.addr);
+            if (use_segs) {
+                err = stlink_write_sram_segments(sl, segs, nsegs);
             } else {
                 err = stlink_fwrite_sram(sl, o.filename, o.addr);
             }
@@ -354,9 +487,10 @@ int32_t main(int32_t ac, char** av) {
     err = 0; // success
 
 on_error:
+    stlink_poll_log_stats(sl);
     stlink_exit_debug_mode(sl);
     stlink_close(sl);
-    free(mem);
+    stlink_free_segments(segs, nsegs);
 
     return (err);
 }
@@ -106,6 +106,14 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
             o->opt = ENABLE_OPT;
         } else if (strcmp(av[0], "--mass-erase") == 0) {
             o->mass_erase = ENABLE_OPT;
+        } else if (strcmp(av[0], "--delta") == 0) {
+            o->delta = ENABLE_OPT;
+        } else if (strcmp(av[0], "--blank-check") == 0) {
+            o->blank_check = ENABLE_OPT;
+        } else if (strcmp(av[0], "--compress") == 0) {
+            o->compress = ENABLE_OPT;
+        } else if (strcmp(av[0], "--gang") == 0) {
+            o->gang = ENABLE_OPT;
         } else if (strcmp(av[0], "--reset") == 0) {
             o->reset = 1;
         } else if (strcmp(av[0], "--serial") == 0 || starts_with(av[0], "--serial=")) {
@@ -191,6 +199,10 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
                 o->format = FLASH_FORMAT_BINARY;
             } else if (strcmp(format, "ihex") == 0) {
                 o->format = FLASH_FORMAT_IHEX;
+            } else if (strcmp(format, "elf") == 0) {
+                o->format = FLASH_FORMAT_ELF;
+            } else if (strcmp(format, "manifest") == 0) {
+                o->format = FLASH_FORMAT_MANIFEST;
             } else {
                 return (bad_arg("format"));
             }
@@ -270,6 +282,9 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
         break;
 
     case FLASH_CMD_READ:     // expect filename, addr and size
+        // ELF and manifests are write only
+        if (o->format == FLASH_FORMAT_ELF || o->format == FLASH_FORMAT_MANIFEST) { return (bad_arg("format")); }
+
         if ((o->area == FLASH_MAIN_MEMORY) || (o->area == FLASH_SYSTEM_MEMORY)) {
             if (ac != 3) { return invalid_args("read <path> <addr> <size>"); }
             
@@ -376,7 +391,8 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
             } else {
                 o->addr = (stm32_addr_t) addr;
             }
-        } else if (o->format == FLASH_FORMAT_IHEX) { // expect filename
+        } else if (o->format == FLASH_FORMAT_IHEX || o->format == FLASH_FORMAT_ELF ||
+                   o->format == FLASH_FORMAT_MANIFEST) { // expect filename
             if (ac != 1) { return (invalid_args("write <path>")); }
 
             o->filename = av[0];
@@ -389,5 +405,10 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
     default: break;
     }
 
+    // gang mode writes the main memory of every connected probe
+    if (o->gang && (o->cmd != FLASH_CMD_WRITE || o->serial[0] != 0 || o->area != FLASH_MAIN_MEMORY)) {
+        return (bad_arg("--gang"));
+    }
+
     return (0);
 }
@@ -7,10 +7,10 @@
 #ifndef FLASH_OPTS_H
 #define FLASH_OPTS_H
 
-#define FLASH_OPTS_INITIALIZER {0, { 0 }, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+#define FLASH_OPTS_INITIALIZER {0, { 0 }, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
 
 enum flash_cmd {FLASH_CMD_NONE = 0, FLASH_CMD_WRITE = 1, FLASH_CMD_READ = 2, FLASH_CMD_ERASE = 3, CMD_RESET = 4};
-enum flash_format {FLASH_FORMAT_BINARY = 0, FLASH_FORMAT_IHEX = 1};
+enum flash_format {FLASH_FORMAT_BINARY = 0, FLASH_FORMAT_IHEX = 1, FLASH_FORMAT_ELF = 2, FLASH_FORMAT_MANIFEST = 3};
 enum flash_area {FLASH_MAIN_MEMORY = 0, FLASH_SYSTEM_MEMORY = 1, FLASH_OTP = 2, FLASH_OPTION_BYTES = 3, FLASH_OPTION_BYTES_BOOT_ADD = 4, FLASH_OPTCR = 5, FLASH_OPTCR1 = 6};
 
 struct flash_opts {
@@ -27,6 +27,10 @@ struct flash_opts {
     uint32_t flash_size;  // --flash=n[k, M]
     int32_t opt;          // enable empty tail data drop optimization
     int32_t mass_erase;   // Use mass-erase when programming flash instead of sector-erase
+    int32_t delta;        // erase and program only the pages that differ from the file
+    int32_t blank_check;  // skip erasing pages that are already blank
+    int32_t gang;         // write to all connected probes at once
+    int32_t compress;     // send compressed data to the flash loader
     int32_t freq;         // --freq=n[k, M] frequency of JTAG/SWD
     enum connect_type connect;
 };
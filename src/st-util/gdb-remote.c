@@ -19,17 +19,79 @@
 
 static const char hex[] = "0123456789abcdef";
 
-int32_t gdb_send_packet(int32_t fd, char* data) {
-    uint32_t data_length = (uint32_t) strlen(data);
-    int32_t length = data_length + 4;
-    char* packet = malloc(length); // '$' data (hex) '#' cksum (hex)
+#define ALLOC_STEP 1024
 
-    memset(packet, 0, length);
+void gdb_conn_init(gdb_conn_t *conn, int32_t fd) {
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+}
 
-    packet[0] = '$';
+void gdb_conn_free(gdb_conn_t *conn) {
+    free(conn->packet);
+    free(conn->out);
+    conn->packet = NULL;
+    conn->out = NULL;
+    conn->packet_size = conn->out_size = 0;
+}
+
+// refills the receive buffer with whatever the socket has, at least one byte
+static int32_t gdb_fill(gdb_conn_t *conn) {
+    ssize_t n = read(conn->fd, conn->in, sizeof(conn->in));
+
+    if (n <= 0) {
+        return (-2);
+    }
+
+    conn->in_pos = 0;
+    conn->in_len = (uint32_t) n;
+    return (0);
+}
+
+static int32_t gdb_write_all(gdb_conn_t *conn, const char *data, uint32_t length) {
+    while (length > 0) {
+        ssize_t n = write(conn->fd, (void*) data, length);
+
+        if (n <= 0) {
+            return (-2);
+        }
+
+        data += n;
+        length -= (uint32_t) n;
+    }
+
+    return (0);
+}
+
+static int32_t gdb_grow(char **buffer, uint32_t *size, uint32_t needed) {
+    if (needed <= *size) {
+        return (0);
+    }
+
+    uint32_t new_size = (needed + ALLOC_STEP - 1) / ALLOC_STEP * ALLOC_STEP;
+    void* p = realloc(*buffer, new_size);
+
+    if (p == NULL) {
+        return (-2);
+    }
+
+    *buffer = p;
+    *size = new_size;
+    return (0);
+}
+
+int32_t gdb_send_packet(gdb_conn_t *conn, const char* data) {
+    uint32_t data_length = (uint32_t) strlen(data);
+    uint32_t length = data_length + 4; // '$' data (hex) '#' cksum (hex)
 
+    if (gdb_grow(&conn->out, &conn->out_size, length)) {
+        return (-2);
+    }
+
+    char* packet = conn->out;
     uint8_t cksum = 0;
 
+    packet[0] = '$';
+
     for (uint32_t i = 0; i < data_length; i++) {
         packet[i + 1] = data[i];
         cksum += data[i];
@@ -40,41 +102,38 @@ int32_t gdb_send_packet(int32_t fd, char* data) {
     packet[length - 1] = hex[cksum & 0xf];
 
     while (1) {
-        if (write(fd, packet, length) != length) {
-            free(packet);
+        if (gdb_write_all(conn, packet, length)) {
             return (-2);
         }
 
-        char ack;
+        if (conn->no_ack) {
+            return (0);
+        }
 
-        if (read(fd, &ack, 1) != 1) {
-            free(packet);
+        if (conn->in_pos == conn->in_len && gdb_fill(conn)) {
             return (-2);
         }
 
-        if (ack == '+') {
-            free(packet);
+        if (conn->in[conn->in_pos++] == '+') {
             return (0);
         }
     }
 }
 
-#define ALLOC_STEP 1024
-
-int32_t gdb_recv_packet(int32_t fd, char** buffer) {
-    uint32_t packet_size = ALLOC_STEP + 1, packet_idx = 0;
-    uint8_t cksum = 0;
+int32_t gdb_recv_packet(gdb_conn_t *conn, char** buffer) {
+    uint32_t packet_idx;
+    uint8_t cksum;
     char recv_cksum[3] = {0};
-    char* packet_buffer = malloc(packet_size);
     uint32_t state;
 
-    if (packet_buffer == NULL) {
+    if (gdb_grow(&conn->packet, &conn->packet_size, ALLOC_STEP + 1)) {
         return (-2);
     }
 
 start:
     state = 0;
     packet_idx = 0;
+    cksum = 0;
     /*
      * 0: waiting $
      * 1: data, waiting #
@@ -83,43 +142,46 @@ start:
      * 4: fin
      */
 
-    char c;
-
     while (state != 4) {
-        if (read(fd, &c, 1) != 1) {
-            free(packet_buffer);
+        if (conn->in_pos == conn->in_len && gdb_fill(conn)) {
             return (-2);
         }
 
-        switch (state) {
-        case 0:
+        if (state == 1) {
+            // take the data up to '#' straight from the receive buffer
+            char* data = conn->in + conn->in_pos;
+            uint32_t avail = conn->in_len - conn->in_pos;
+            char* end = memchr(data, '#', avail);
+            uint32_t n = end ? (uint32_t) (end - data) : avail;
 
-            if (c != '$') { /* ignore */
-            } else {
-                state = 1;
+            if (gdb_grow(&conn->packet, &conn->packet_size, packet_idx + n + 1)) {
+                return (-2);
             }
 
-            break;
+            for (uint32_t i = 0; i < n; i++) {
+                cksum += (uint8_t) data[i];
+            }
 
-        case 1:
+            memcpy(conn->packet + packet_idx, data, n);
+            packet_idx += n;
+            conn->in_pos += n;
 
-            if (c == '#') {
+            if (end) {
+                conn->in_pos++;
                 state = 2;
+            }
+
+            continue;
+        }
+
+        char c = conn->in[conn->in_pos++];
+
+        switch (state) {
+        case 0:
+
+            if (c != '$') { /* ignore */
             } else {
-                packet_buffer[packet_idx++] = c;
-                cksum += c;
-
-                if (packet_idx == packet_size) {
-                    packet_size += ALLOC_STEP;
-                    void* p = realloc(packet_buffer, packet_size);
-
-                    if (p != NULL) {
-                        packet_buffer = p;
-                    } else {
-                        free(packet_buffer);
-                        return (-2);
-                    }
-                }
+                state = 1;
             }
 
             break;
@@ -141,45 +203,49 @@ start:
     if (recv_cksum_int != cksum) {
         char nack = '-';
 
-        if (write(fd, &nack, 1) != 1) {
-            free(packet_buffer);
+        // without acks there is no retransmission, just drop the packet
+        if (!conn->no_ack && gdb_write_all(conn, &nack, 1)) {
             return (-2);
         }
 
         goto start;
-    } else {
+    } else if (!conn->no_ack) {
         char ack = '+';
 
-        if (write(fd, &ack, 1) != 1) {
-            free(packet_buffer);
+        if (gdb_write_all(conn, &ack, 1)) {
             return (-2);
         }
     }
 
-    packet_buffer[packet_idx] = 0;
-    *buffer = packet_buffer;
+    conn->packet[packet_idx] = 0;
+    *buffer = conn->packet;
 
     return (packet_idx);
 }
 
 /*
+ * Waits up to timeout_ms for GDB's interrupt and returns as soon as it arrives.
  * Here we skip any characters which are not \x03, GDB interrupt.
- * As we use the mode with ACK, in a (very unlikely) situation of a packet lost
- * because of this skipping, it will be resent anyway.
+ * GDB sends nothing else while the target runs, so no packet is lost by
+ * this skipping, even in no-ack mode. Bytes already buffered come first.
  */
-int32_t gdb_check_for_interrupt(int32_t fd) {
-    struct pollfd pfd;
-    pfd.fd = fd;
-    pfd.events = POLLIN;
+int32_t gdb_wait_for_interrupt(gdb_conn_t *conn, int32_t timeout_ms) {
+    if (conn->in_pos == conn->in_len) {
+        struct pollfd pfd;
+        pfd.fd = conn->fd;
+        pfd.events = POLLIN;
 
-    if (poll(&pfd, 1, 0) != 0) {
-        char c;
+        if (poll(&pfd, 1, timeout_ms) == 0) {
+            return (0);
+        }
 
-        if (read(fd, &c, 1) != 1) {
+        if (gdb_fill(conn)) {
             return (-2);
         }
+    }
 
-        if (c == '\x03') {
+    while (conn->in_pos < conn->in_len) {
+        if (conn->in[conn->in_pos++] == '\x03') {
             return (1); // ^C
         }
     }
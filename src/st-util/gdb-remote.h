@@ -3,8 +3,29 @@
 
 #include <stdint.h>
 
-int32_t gdb_send_packet(int32_t fd, char* data);
-int32_t gdb_recv_packet(int32_t fd, char** buffer);
-int32_t gdb_check_for_interrupt(int32_t fd);
+#define GDB_IN_BUF_SIZE 4096
+
+/*
+ * Connection to GDB: one read() fills the receive buffer with as much as
+ * the socket holds, the packet buffers are kept for the whole session.
+ */
+typedef struct gdb_conn {
+    int32_t fd;
+    int32_t no_ack;                 // QStartNoAckMode accepted, no '+'/'-' exchanged
+    char in[GDB_IN_BUF_SIZE];       // received bytes not parsed yet: in[in_pos..in_len)
+    uint32_t in_pos;
+    uint32_t in_len;
+    char* packet;                   // last packet from gdb_recv_packet()
+    uint32_t packet_size;
+    char* out;                      // framed packet for gdb_send_packet()
+    uint32_t out_size;
+} gdb_conn_t;
+
+void gdb_conn_init(gdb_conn_t *conn, int32_t fd);
+void gdb_conn_free(gdb_conn_t *conn);
+int32_t gdb_send_packet(gdb_conn_t *conn, const char* data);
+// *buffer stays valid until the next call, it must not be freed
+int32_t gdb_recv_packet(gdb_conn_t *conn, char** buffer);
+int32_t gdb_wait_for_interrupt(gdb_conn_t *conn, int32_t timeout_ms);
 
 #endif // GDB_REMOTE_H
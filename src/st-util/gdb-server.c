@@ -29,6 +29,7 @@
 #include <stlink.h>
 #include "gdb-server.h"
 #include "gdb-remote.h"
+#include "memory-cache.h"
 #include "memory-map.h"
 #include "semihosting.h"
 
@@ -46,6 +47,12 @@
 // Semihosting doesn't have a short option, we define a value to identify it
 #define SEMIHOSTING_OPTION 128
 #define SERIAL_OPTION 127
+#define BLANK_CHECK_OPTION 126
+#define HALT_POLL_OPTION 125
+
+// DHCSR polls without delay after resuming, before the delay starts to double
+#define HALT_POLL_TIGHT 16
+#define HALT_POLL_MAX_MS 100
 
 // always update the FLASH_PAGE before each use, by calling stlink_calculate_pagesize
 #define FLASH_PAGE (sl->flash_pgsz)
@@ -72,6 +79,8 @@ typedef struct _st_state_t {
     int32_t freq;
     char serialnumber[STLINK_SERIAL_BUFFER_SIZE];
     bool semihosting;
+    bool blank_check;
+    uint32_t halt_poll_max;     // ms, longest delay between halt checks
     const char* current_memory_map;
 } st_state_t;
 
@@ -122,6 +131,8 @@ int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
         {"version", no_argument, NULL, 'V'},
         {"semihosting", no_argument, NULL, SEMIHOSTING_OPTION},
         {"serial", required_argument, NULL, SERIAL_OPTION},
+        {"blank-check", no_argument, NULL, BLANK_CHECK_OPTION},
+        {"halt-poll-max", required_argument, NULL, HALT_POLL_OPTION},
         {0, 0, 0, 0},
     };
     const char * help_str = "%s - usage:\n\n"
@@ -145,6 +156,11 @@ int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
                             "\t\t\tEnable semihosting support.\n"
                             "  --serial <serial>\n"
                             "\t\t\tUse a specific serial number.\n"
+                            "  --blank-check\n"
+                            "\t\t\tDo not erase flash pages that are already blank.\n"
+                            "  --halt-poll-max=<ms>\n"
+                            "\t\t\tLongest delay between checks for a halted core (default: "
+                            STRINGIFY(HALT_POLL_MAX_MS) ").\n"
                             "\n"
                             "The STLINK device to use can be specified in the environment\n"
                             "variable STLINK_DEVICE on the format <USB_BUS>:<USB_ADDR>.\n"
@@ -210,6 +226,17 @@ int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
             printf("use serial %s\n", optarg);
             memcpy(st->serialnumber, optarg, STLINK_SERIAL_BUFFER_SIZE);
             break;
+        case BLANK_CHECK_OPTION:
+            st->blank_check = true;
+            break;
+        case HALT_POLL_OPTION:
+            if (sscanf(optarg, "%i", &q) != 1 || q < 0) {
+                fprintf(stderr, "Invalid halt poll delay %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+
+            st->halt_poll_max = q;
+            break;
         }
 
 
@@ -233,6 +260,7 @@ int32_t main(int32_t argc, char** argv) {
     state.logging_level = DEFAULT_LOGGING_LEVEL;
     state.listen_port = DEFAULT_GDB_LISTEN_PORT;
     state.connect_mode = CONNECT_NORMAL; // by default, reset board
+    state.halt_poll_max = HALT_POLL_MAX_MS;
     parse_options(argc, argv, &state);
 
     printf("st-util %s\n", STLINK_VERSION);
@@ -693,6 +721,11 @@ static int32_t flash_go(stlink_t *sl, st_state_t *st) {
             // update FLASH_PAGE
             stlink_calculate_pagesize(sl, page);
 
+            if (st->blank_check && stlink_is_page_erased(sl, page, FLASH_PAGE)) {
+                ILOG("flash_erase: page %08x already blank\n", page);
+                continue;
+            }
+
             ILOG("flash_erase: page %08x\n", page);
             ret = stlink_erase_flash_page(sl, page);
             if (ret) { goto error; }
@@ -874,19 +907,156 @@ static void cache_sync(stlink_t *sl) {
     if (ccr & (STLINK_REG_CM7_CCR_IC | STLINK_REG_CM7_CCR_DC)) { cache_flush(sl, ccr); }
 }
 
+/*
+ * Register file of the halted core, fetched once per halt: the core registers
+ * with one READALLREGS, the special and FP registers in one debug32 batch.
+ * 'g' and 'p' are answered from it, 'G' and 'P' update it after the write.
+ */
+static struct stlink_reg reg_cache;
+static bool reg_cache_valid;
+static int32_t reg_cache_fpu = -1;  // FPU present, -1 until checked
+
+static int32_t reg_cache_fetch(stlink_t *sl) {
+    bool halted;
+    int32_t ret;
+
+    if (reg_cache_valid) { return (0); }
+
+    // registers of a running core are read, but not kept
+    halted = (stlink_status(sl) == 0 && sl->core_stat == TARGET_HALTED);
+
+    if (reg_cache_fpu < 0) {
+        uint32_t mvfr0 = 0;
+        reg_cache_fpu = (stlink_read_debug32(sl, STLINK_REG_MVFR0, &mvfr0) == 0 && mvfr0 != 0);
+    }
+
+    memset(&reg_cache, 0, sizeof(reg_cache));
+    ret = stlink_read_all_regs(sl, &reg_cache);
+
+    if (!ret && reg_cache_fpu) {
+        ret = stlink_read_all_unsupported_regs(sl, &reg_cache);
+    } else if (!ret) {
+        // no FP registers to read, they stay 0
+        ret = stlink_read_unsupported_reg(sl, 0x1C, &reg_cache);
+    }
+
+    reg_cache_valid = (ret == 0 && halted);
+    return (ret);
+}
+
+// maps a gdb register number to its slot in the cache
+static uint32_t *reg_cache_slot(uint32_t id) {
+    if (id < 16) { return (&reg_cache.r[id]); }
+    if (id == 0x19) { return (&reg_cache.xpsr); }
+    if (id == 0x1A) { return (&reg_cache.main_sp); }
+    if (id == 0x1B) { return (&reg_cache.process_sp); }
+    if (id >= 0x20 && id < 0x40) { return (&reg_cache.s[id - 0x20]); }
+    if (id == 0x40) { return (&reg_cache.fpscr); }
+
+    return (NULL);
+}
+
+static int32_t reg_cache_get(uint32_t id, uint32_t *value) {
+    uint32_t *slot = reg_cache_slot(id);
+
+    if (slot != NULL) {
+        *value = *slot;
+    } else if (id == 0x1C) {
+        *value = reg_cache.control;
+    } else if (id == 0x1D) {
+        *value = reg_cache.faultmask;
+    } else if (id == 0x1E) {
+        *value = reg_cache.basepri;
+    } else if (id == 0x1F) {
+        *value = reg_cache.primask;
+    } else {
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * value as stored by stlink_write_reg()/stlink_write_unsupported_reg().
+ * SP is one of MSP/PSP, selected by CONTROL.SPSEL, so a write to any of
+ * them drops the cache instead of leaving the aliases stale.
+ */
+static void reg_cache_set(uint32_t id, uint32_t value) {
+    uint32_t *slot = reg_cache_slot(id);
+
+    if (id == 13 || id == 0x1A || id == 0x1B || id == 0x1C) {
+        reg_cache_valid = false;
+    } else if (slot != NULL) {
+        *slot = value;
+    } else if (id == 0x1D) {
+        reg_cache.faultmask = (uint8_t) (value >> 24);
+    } else if (id == 0x1E) {
+        reg_cache.basepri = (uint8_t) (value >> 24);
+    } else if (id == 0x1F) {
+        reg_cache.primask = (uint8_t) (value >> 24);
+    }
+}
+
+/*
+ * The core ran or was reset: registers and SRAM must be read again.
+ * keep_flash is false when the flash or the whole target may have changed.
+ */
+static void invalidate_target_caches(bool keep_flash) {
+    reg_cache_valid = false;
+
+    if (!keep_flash) { reg_cache_fpu = -1; }
+
+    mem_cache_invalidate(keep_flash);
+}
+
+static int32_t hex_nibble(char c) {
+    if (c >= '0' && c <= '9') { return (c - '0'); }
+    if (c >= 'a' && c <= 'f') { return (c - 'a' + 10); }
+    if (c >= 'A' && c <= 'F') { return (c - 'A' + 10); }
+
+    return (-1);
+}
+
 static uint32_t unhexify(const char *in, char *out, uint32_t out_count) {
     uint32_t i;
-    uint32_t c;
 
     for (i = 0; i < out_count; i++) {
-        if (sscanf(in + (2 * i), "%02x", &c) != 1) { return (i); }
+        int32_t hi = hex_nibble(in[2 * i]);
+        int32_t lo = (hi < 0) ? -1 : hex_nibble(in[2 * i + 1]);
+
+        if (lo < 0) { return (i); }
 
-        out[i] = (char)c;
+        out[i] = (char) ((hi << 4) | lo);
     }
 
     return (i);
 }
 
+// removes the '}' escapes of binary packet data, returns the decoded length
+static uint32_t unescape_binary(const char *in, uint32_t in_count, uint8_t *out) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < in_count; i++) {
+        if (in[i] == 0x7d && i + 1 < in_count) {
+            out[count++] = in[++i] ^ 0x20;
+        } else {
+            out[count++] = in[i];
+        }
+    }
+
+    return (count);
+}
+
+/*
+ * PacketSize offered in qSupported: an 'm' reply or an 'X' packet carries
+ * the largest block the probe moves at once, never less than before.
+ */
+static uint32_t gdb_packet_size(stlink_t *sl) {
+    uint32_t size = 2 * sl->xfer_caps.block_size + 32;
+
+    return (size > 0x3fff ? size : 0x3fff);
+}
+
 int32_t serve(stlink_t *sl, st_state_t *st) {
     SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -942,11 +1112,15 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
     init_data_watchpoints(sl);
 
     init_cache(sl);
+    invalidate_target_caches(false);
 
     st->current_memory_map = make_memory_map(sl);
 
     ILOG("GDB connected.\n");
 
+    gdb_conn_t conn;
+    gdb_conn_init(&conn, client);
+
     /*
      * To allow resetting the chip from GDB it is required to emulate attaching
      * and detaching to target.
@@ -954,16 +1128,19 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
     uint32_t attached = 1;
     // if a critical error is detected, break from the loop
     int32_t critical_error = 0;
+    // QStartNoAckMode takes effect once its reply is acknowledged
+    int32_t start_no_ack = 0;
     int32_t ret;
 
     while (1) {
         ret = 0;
         char* packet;
 
-        int32_t status = gdb_recv_packet(client, &packet);
+        int32_t status = gdb_recv_packet(&conn, &packet);
 
         if (status < 0) {
             ELOG("cannot recv: %d\n", status);
+            gdb_conn_free(&conn);
             close_socket(client);
             return (1);
         }
@@ -995,7 +1172,12 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             DLOG("query: %s;%s\n", queryName, params);
 
             if (!strcmp(queryName, "Supported")) {
-                reply = strdup("PacketSize=3fff;qXfer:memory-map:read+;qXfer:features:read+");
+                char supported[96];
+
+                snprintf(supported, sizeof(supported),
+                         "PacketSize=%x;qXfer:memory-map:read+;qXfer:features:read+;QStartNoAckMode+",
+                         gdb_packet_size(sl));
+                reply = strdup(supported);
             } else if (!strcmp(queryName, "Xfer")) {
                 char *type, *op, *__s_addr, *s_length;
                 char *tok = params;
@@ -1066,6 +1248,7 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                 if (!strncmp(cmd, "resume", 6)) {                               // resume
                     DLOG("Rcmd: resume\n");
                     cache_sync(sl);
+                    invalidate_target_caches(true);
                     ret = stlink_run(sl, RUN_NORMAL);
 
                     if (ret) {
@@ -1077,6 +1260,8 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
                 } else if (!strncmp(cmd, "halt", 4)) {                          // halt
                     ret = stlink_force_debug(sl);
+                    // gdb may have read the target while it ran
+                    invalidate_target_caches(true);
 
                     if (ret) {
                         DLOG("Rcmd: halt failed\n");
@@ -1088,6 +1273,7 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
                 } else if (!strncmp(cmd, "jtag_reset", 10)) {                   // jtag_reset
                     reply = strdup("OK");
+                    invalidate_target_caches(true);
 
                     ret = stlink_reset(sl, RESET_HARD);
                     if (ret) {
@@ -1106,6 +1292,7 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                         DLOG("Rcmd: jtag_reset\n");
                     }
                 } else if (!strncmp(cmd, "reset", 5)) {     // reset
+                    invalidate_target_caches(true);
 
                     ret = stlink_force_debug(sl);
                     if (ret) {
@@ -1174,6 +1361,8 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                 DLOG("FlashErase: addr:%08x,len:%04x\n",
                      addr, length);
 
+                mem_cache_invalidate_flash();
+
                 if (flash_add_block(addr, length, sl) < 0) {
                     reply = strdup("E00");
                 } else {
@@ -1189,19 +1378,12 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                 uint32_t addr = (uint32_t) strtoul(__s_addr, NULL, 16);
                 uint32_t data_length = status - (uint32_t) (data - packet);
 
+                mem_cache_invalidate_flash();
+
                 // Length of decoded data cannot be more than encoded, as escapes are removed.
                 // Additional byte is reserved for alignment fix.
                 uint8_t *decoded = calloc(1, data_length + 1);
-                uint32_t dec_index = 0;
-
-                for (uint32_t i = 0; i < data_length; i++) {
-                    if (data[i] == 0x7d) {
-                        i++;
-                        decoded[dec_index++] = data[i] ^ 0x20;
-                    } else {
-                        decoded[dec_index++] = data[i];
-                    }
-                }
+                uint32_t dec_index = unescape_binary(data, data_length, decoded);
 
                 // fix alignment
                 if (dec_index % 2 != 0) { dec_index++; }
@@ -1216,6 +1398,9 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
                 free(decoded);
             } else if (!strcmp(cmdName, "FlashDone")) {
+                // the flash is rewritten and the target reset
+                invalidate_target_caches(false);
+
                 if (flash_go(sl, st)) {
                     reply = strdup("E08");
                 } else {
@@ -1233,15 +1418,25 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
         case 'c':
             cache_sync(sl);
+            invalidate_target_caches(true);
             ret = stlink_run(sl, RUN_NORMAL);
 
             if (ret) { DLOG("Semihost: run failed\n"); }
 
+            /*
+             * Check DHCSR back to back right after resuming, so that short runs to a
+             * breakpoint or semihosting call are seen at once, then double the delay
+             * up to halt_poll_max. An interrupt from GDB ends the wait at any time.
+             */
+            uint32_t halt_polls = 0;
+            int32_t halt_wait_ms = 0;
+
             while (1) {
-                status = gdb_check_for_interrupt(client);
+                status = gdb_wait_for_interrupt(&conn, halt_wait_ms);
 
                 if (status < 0) {
                     ELOG("cannot check for int: %d\n", status);
+                    gdb_conn_free(&conn);
                     close_socket(client);
                     return (1);
                 }
@@ -1306,12 +1501,21 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                         ret = stlink_run(sl, RUN_NORMAL);
 
                         if (ret) { DLOG("Semihost: continue execution failed with stlink_run\n"); }
+
+                        // the next call may follow soon, poll tightly again
+                        halt_polls = 0;
+                        halt_wait_ms = 0;
+                        continue;
                     } else {
                         break;
                     }
                 }
 
-                usleep(100000);
+                if (++halt_polls > HALT_POLL_TIGHT) {
+                    halt_wait_ms = halt_wait_ms ? halt_wait_ms * 2 : 1;
+
+                    if (halt_wait_ms > (int32_t) st->halt_poll_max) { halt_wait_ms = (int32_t) st->halt_poll_max; }
+                }
             }
 
             reply = strdup("S05"); // TRAP
@@ -1319,6 +1523,7 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
         case 's':
             cache_sync(sl);
+            invalidate_target_caches(true);
             ret = stlink_step(sl);
 
             if (ret) {
@@ -1343,14 +1548,14 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             break;
 
         case 'g':
-            ret = stlink_read_all_regs(sl, &regp);
+            ret = reg_cache_fetch(sl);
 
             if (ret) { DLOG("g packet: read_all_regs failed\n"); }
 
             reply = calloc(1, 8 * 16 + 1);
 
             for (int32_t i = 0; i < 16; i++) {
-                sprintf(&reply[i * 8], "%08x", (uint32_t) htonl(regp.r[i]));
+                sprintf(&reply[i * 8], "%08x", (uint32_t) htonl(reg_cache.r[i]));
             }
 
             break;
@@ -1358,40 +1563,15 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
         case 'p': {
             uint32_t id = (uint32_t) strtoul(&packet[1], NULL, 16);
             uint32_t myreg = 0xDEADDEAD;
+            uint32_t value;
 
-            if (id < 16) {
-                ret = stlink_read_reg(sl, id, &regp);
-                myreg = htonl(regp.r[id]);
-            } else if (id == 0x19) {
-                ret = stlink_read_reg(sl, 16, &regp);
-                myreg = htonl(regp.xpsr);
-            } else if (id == 0x1A) {
-                ret = stlink_read_reg(sl, 17, &regp);
-                myreg = htonl(regp.main_sp);
-            } else if (id == 0x1B) {
-                ret = stlink_read_reg(sl, 18, &regp);
-                myreg = htonl(regp.process_sp);
-            } else if (id == 0x1C) {
-                ret = stlink_read_unsupported_reg(sl, id, &regp);
-                myreg = htonl(regp.control);
-            } else if (id == 0x1D) {
-                ret = stlink_read_unsupported_reg(sl, id, &regp);
-                myreg = htonl(regp.faultmask);
-            } else if (id == 0x1E) {
-                ret = stlink_read_unsupported_reg(sl, id, &regp);
-                myreg = htonl(regp.basepri);
-            } else if (id == 0x1F) {
-                ret = stlink_read_unsupported_reg(sl, id, &regp);
-                myreg = htonl(regp.primask);
-            } else if (id >= 0x20 && id < 0x40) {
-                ret = stlink_read_unsupported_reg(sl, id, &regp);
-                myreg = htonl(regp.s[id - 0x20]);
-            } else if (id == 0x40) {
-                ret = stlink_read_unsupported_reg(sl, id, &regp);
-                myreg = htonl(regp.fpscr);
-            } else {
+            ret = reg_cache_fetch(sl);
+
+            if (reg_cache_get(id, &value)) {
                 ret = 1;
                 reply = strdup("E00");
+            } else {
+                myreg = htonl(value);
             }
 
             if (ret) { DLOG("p packet: could not read register with id %u\n", id); }
@@ -1421,24 +1601,19 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                 ret = stlink_write_reg(sl, ntohl(value), 17);
             } else if (reg == 0x1B) {
                 ret = stlink_write_reg(sl, ntohl(value), 18);
-            } else if (reg == 0x1C) {
-                ret = stlink_write_unsupported_reg(sl, ntohl(value), reg, &regp);
-            } else if (reg == 0x1D) {
-                ret = stlink_write_unsupported_reg(sl, ntohl(value), reg, &regp);
-            } else if (reg == 0x1E) {
-                ret = stlink_write_unsupported_reg(sl, ntohl(value), reg, &regp);
-            } else if (reg == 0x1F) {
-                ret = stlink_write_unsupported_reg(sl, ntohl(value), reg, &regp);
-            } else if (reg >= 0x20 && reg < 0x40) {
-                ret = stlink_write_unsupported_reg(sl, ntohl(value), reg, &regp);
-            } else if (reg == 0x40) {
+            } else if (reg >= 0x1C && reg <= 0x40) {
                 ret = stlink_write_unsupported_reg(sl, ntohl(value), reg, &regp);
             } else {
                 ret = 1;
                 reply = strdup("E00");
             }
 
-            if (ret) { DLOG("P packet: stlink_write_unsupported_reg failed with reg %u\n", reg); }
+            if (ret) {
+                DLOG("P packet: stlink_write_unsupported_reg failed with reg %u\n", reg);
+                reg_cache_valid = false;
+            } else {
+                reg_cache_set(reg, ntohl(value));
+            }
 
             if (reply == NULL) { reply = strdup("OK"); /* Note: NULL may not be zero */ }
 
@@ -1453,7 +1628,12 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                 uint32_t reg = (uint32_t) strtoul(str, NULL, 16);
                 ret = stlink_write_reg(sl, ntohl(reg), i);
 
-                if (ret) { DLOG("G packet: stlink_write_reg failed"); }
+                if (ret) {
+                    DLOG("G packet: stlink_write_reg failed");
+                    reg_cache_valid = false;
+                } else {
+                    reg_cache_set(i, ntohl(reg));
+                }
             }
 
             reply = strdup("OK");
@@ -1465,27 +1645,39 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
             stm32_addr_t start = (stm32_addr_t) strtoul(s_start, NULL, 16);
             uint32_t count = (uint32_t) strtoul(s_count, NULL, 16);
+            uint8_t *data = malloc(count ? count : 1);
+
+            if (data == NULL) {
+                reply = strdup("E00");
+                break;
+            }
 
-            uint32_t adj_start = start % 4;
-            uint32_t count_rnd = (count + adj_start + 4 - 1) / 4 * 4;
+            // served from the cache where possible, misses are read in as few transfers as possible
+            if (mem_cache_read(sl, start, count, data) != 0) {
+                // the range may run into unmapped memory, return what the first block has
+                uint32_t adj_start = start % 4;
+                uint32_t count_rnd = (count + adj_start + 4 - 1) / 4 * 4;
 
-            if (count_rnd > sl->flash_pgsz) { count_rnd = sl->flash_pgsz; }
+                if (count_rnd > sl->flash_pgsz) { count_rnd = sl->flash_pgsz; }
 
-            if (count_rnd > 0x1800) { count_rnd = 0x1800; }
+                if (count_rnd > sl->xfer_caps.block_size) { count_rnd = sl->xfer_caps.block_size; }
 
-            if (count_rnd < count) { count = count_rnd; }
+                if (count_rnd < count) { count = count_rnd; }
 
-            if (stlink_read_mem32(sl, start - adj_start, count_rnd) != 0) { count = 0; }
+                // read failed somehow, don't return stale buffer
+                if (stlink_read_mem32(sl, start - adj_start, count_rnd) != 0) { count = 0; }
 
-            // read failed somehow, don't return stale buffer
+                memcpy(data, sl->q_buf + adj_start, count);
+            }
 
             reply = calloc(1, count * 2 + 1);
 
             for (uint32_t i = 0; i < count; i++) {
-                reply[i * 2 + 0] = hex[sl->q_buf[i + adj_start] >> 4];
-                reply[i * 2 + 1] = hex[sl->q_buf[i + adj_start] & 0xf];
+                reply[i * 2 + 0] = hex[data[i] >> 4];
+                reply[i * 2 + 1] = hex[data[i] & 0xf];
             }
 
+            free(data);
             break;
         }
 
@@ -1498,51 +1690,73 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             uint32_t count = (uint32_t) strtoul(s_count, NULL, 16);
             int32_t err = 0;
 
-            if (start % 4) {
-                uint32_t align_count = 4 - start % 4;
+            // decode into a buffer which is sent as is, alignment is handled by stlink_write_mem()
+            uint8_t *data = malloc(count ? count : 1);
+
+            if (data == NULL) {
+                reply = strdup("E00");
+                break;
+            }
 
-                if (align_count > count) { align_count = count; }
+            if (unhexify(hexdata, (char*) data, count) != count) { err = 1; }
 
-                for (uint32_t i = 0; i < align_count; i++) {
-                    char hextmp[3] = { hexdata[i * 2], hexdata[i * 2 + 1], 0 };
-                    uint8_t byte = (uint8_t) strtoul(hextmp, NULL, 16);
-                    sl->q_buf[i] = byte;
-                }
+            if (!err) {
+                err |= stlink_write_mem(sl, start, count, data);
+                cache_change(start, count);
+            }
 
-                err |= stlink_write_mem8(sl, start, align_count);
-                cache_change(start, align_count);
-                start += align_count;
-                count -= align_count;
-                hexdata += 2 * align_count;
+            if (err) {
+                mem_cache_invalidate(true);
+            } else {
+                mem_cache_write(start, count, data);
             }
 
-            if (count - count % 4) {
-                uint32_t aligned_count = count - count % 4;
+            free(data);
 
-                for (uint32_t i = 0; i < aligned_count; i++) {
-                    char hextmp[3] = { hexdata[i * 2], hexdata[i * 2 + 1], 0 };
-                    uint8_t byte = (uint8_t) strtoul(hextmp, NULL, 16);
-                    sl->q_buf[i] = byte;
-                }
+            reply = strdup(err ? "E00" : "OK");
+            break;
+        }
+
+        case 'X': {
+            // Xaddr,length:binary data with '#', '$', '}' and '*' escaped
+            char* s_start = &packet[1];
+            char* s_count = strstr(&packet[1], ",");
+            char* bindata = strstr(packet, ":");
 
-                err |= stlink_write_mem32(sl, start, aligned_count);
-                cache_change(start, aligned_count);
-                count -= aligned_count;
-                start += aligned_count;
-                hexdata += 2 * aligned_count;
+            if (s_count == NULL || bindata == NULL) {
+                reply = strdup("E00");
+                break;
             }
 
-            if (count) {
-                for (uint32_t i = 0; i < count; i++) {
-                    char hextmp[3] = { hexdata[i * 2], hexdata[i * 2 + 1], 0 };
-                    uint8_t byte = (uint8_t) strtoul(hextmp, NULL, 16);
-                    sl->q_buf[i] = byte;
-                }
+            bindata++;
+
+            stm32_addr_t start = (stm32_addr_t) strtoul(s_start, NULL, 16);
+            uint32_t count = (uint32_t) strtoul(s_count + 1, NULL, 16);
+            uint32_t data_length = status - (uint32_t) (bindata - packet);
+            uint8_t *data = malloc(data_length ? data_length : 1);
+            int32_t err = 0;
+
+            if (data == NULL) {
+                reply = strdup("E00");
+                break;
+            }
 
-                err |= stlink_write_mem8(sl, start, count);
+            // a zero length write is how GDB probes for 'X' support
+            if (unescape_binary(bindata, data_length, data) != count) {
+                err = 1;
+            } else if (count) {
+                err |= stlink_write_mem(sl, start, count, data);
                 cache_change(start, count);
             }
 
+            if (err) {
+                mem_cache_invalidate(true);
+            } else {
+                mem_cache_write(start, count, data);
+            }
+
+            free(data);
+
             reply = strdup(err ? "E00" : "OK");
             break;
         }
@@ -1630,6 +1844,7 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
         case 'R': {
             // reset the core.
+            invalidate_target_caches(true);
             ret = stlink_reset(sl, RESET_SOFT_AND_HALT);
             if (ret) { DLOG("R packet : stlink_reset failed\n"); }
 
@@ -1660,12 +1875,23 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             if (ret) { DLOG("Kill: stlink_force_debug failed\n"); }
 
             init_cache(sl);
+            invalidate_target_caches(false);
             init_code_breakpoints(sl);
             init_data_watchpoints(sl);
 
             reply = NULL; // no response
             break;
 
+        case 'Q':
+            if (!strcmp(packet, "QStartNoAckMode")) {
+                start_no_ack = 1;
+                reply = strdup("OK");
+            } else {
+                reply = strdup("");
+            }
+
+            break;
+
         default:
             reply = strdup("");
         }
@@ -1673,12 +1899,12 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
         if (reply) {
             DLOG("send: %s\n", reply);
 
-            int32_t result = gdb_send_packet(client, reply);
+            int32_t result = gdb_send_packet(&conn, reply);
 
             if (result != 0) {
                 ELOG("cannot send: %d\n", result);
                 free(reply);
-                free(packet);
+                gdb_conn_free(&conn);
                 close_socket(client);
                 return (1);
             }
@@ -1686,14 +1912,20 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             free(reply);
         }
 
+        if (start_no_ack) {
+            DLOG("no-ack mode\n");
+            conn.no_ack = 1;
+            start_no_ack = 0;
+        }
+
         if (critical_error) {
+            gdb_conn_free(&conn);
             close_socket(client);
             return (1);
         }
-
-        free(packet);
     }
 
+    gdb_conn_free(&conn);
     close_socket(client);
     return (0);
 }
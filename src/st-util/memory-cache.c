@@ -0,0 +1,163 @@
+/*
+ * Read cache of target memory for the gdb server
+ *
+ * While the core is halted, GDB reads the same stack, flash and constant
+ * data again for every backtrace and variable it shows. Whole pages of
+ * flash and SRAM are kept here; other regions (peripherals, core
+ * registers) always go to the target, as reading them may have side
+ * effects or return a different value every time.
+ *
+ * Pages are only filled while the core is halted. SRAM pages are valid
+ * until the core runs, flash pages until the flash is programmed.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stlink.h>
+#include "memory-cache.h"
+
+#include <read_write.h>
+
+struct mem_cache_page {
+    bool valid;
+    bool flash;
+    stm32_addr_t base;
+    uint8_t data[MEM_CACHE_PAGE_SIZE];
+};
+
+static struct mem_cache_page mem_cache[MEM_CACHE_PAGES];
+
+static bool mem_cache_in(stm32_addr_t base, stm32_addr_t start, uint32_t size) {
+    return (base >= start && base - start + MEM_CACHE_PAGE_SIZE <= size);
+}
+
+static bool mem_cache_is_flash(stlink_t *sl, stm32_addr_t base) {
+    return (mem_cache_in(base, sl->flash_base, sl->flash_size));
+}
+
+static bool mem_cache_cacheable(stlink_t *sl, stm32_addr_t base) {
+    return (mem_cache_is_flash(sl, base) || mem_cache_in(base, sl->sram_base, sl->sram_size));
+}
+
+static struct mem_cache_page *mem_cache_slot(stm32_addr_t base) {
+    uint32_t n = base / MEM_CACHE_PAGE_SIZE;
+
+    // fold the upper bits in, flash and SRAM pages start at the same low bits
+    return (&mem_cache[(n ^ (n >> 8) ^ (n >> 16)) % MEM_CACHE_PAGES]);
+}
+
+static struct mem_cache_page *mem_cache_lookup(stm32_addr_t base) {
+    struct mem_cache_page *page = mem_cache_slot(base);
+
+    return ((page->valid && page->base == base) ? page : NULL);
+}
+
+/*
+ * Reads pages [base, base + count * MEM_CACHE_PAGE_SIZE) into the cache
+ * with one transfer, so that a long read still needs few round trips
+ */
+static int32_t mem_cache_fill(stlink_t *sl, stm32_addr_t base, uint32_t count) {
+    uint8_t *buf = malloc(count * MEM_CACHE_PAGE_SIZE);
+
+    if (buf == NULL || stlink_read_mem(sl, base, count * MEM_CACHE_PAGE_SIZE, buf)) {
+        free(buf);
+        return (-1);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        stm32_addr_t page_base = base + i * MEM_CACHE_PAGE_SIZE;
+        struct mem_cache_page *page = mem_cache_slot(page_base);
+
+        page->valid = true;
+        page->flash = mem_cache_is_flash(sl, page_base);
+        page->base = page_base;
+        memcpy(page->data, buf + i * MEM_CACHE_PAGE_SIZE, MEM_CACHE_PAGE_SIZE);
+    }
+
+    free(buf);
+    return (0);
+}
+
+int32_t mem_cache_read(stlink_t *sl, stm32_addr_t addr, uint32_t len, uint8_t *dst) {
+    int32_t halted = -1; // checked on the first miss, -1 until then
+
+    while (len) {
+        stm32_addr_t base = addr & ~(MEM_CACHE_PAGE_SIZE - 1);
+        uint32_t offset = addr - base;
+        uint32_t size = MEM_CACHE_PAGE_SIZE - offset;
+        struct mem_cache_page *page;
+
+        if (size > len) { size = len; }
+
+        if (!mem_cache_cacheable(sl, base)) {
+            if (stlink_read_mem(sl, addr, size, dst)) { return (-1); }
+        } else {
+            if ((page = mem_cache_lookup(base)) == NULL && halted < 0) {
+                halted = (stlink_status(sl) == 0 && sl->core_stat == TARGET_HALTED);
+            }
+
+            if (page == NULL && halted) {
+                // fetch this and the following missing pages of the request at once
+                uint32_t count = 1;
+                stm32_addr_t next = base + MEM_CACHE_PAGE_SIZE;
+
+                while (next < addr + len && count < MEM_CACHE_PAGES / 2 &&
+                       mem_cache_cacheable(sl, next) && mem_cache_lookup(next) == NULL) {
+                    count++;
+                    next += MEM_CACHE_PAGE_SIZE;
+                }
+
+                if (mem_cache_fill(sl, base, count) == 0) { page = mem_cache_lookup(base); }
+            }
+
+            if (page != NULL) {
+                memcpy(dst, page->data + offset, size);
+            } else if (stlink_read_mem(sl, addr, size, dst)) {
+                return (-1);
+            }
+        }
+
+        addr += size;
+        dst += size;
+        len -= size;
+    }
+
+    return (0);
+}
+
+// updates cached SRAM after a successful write, flash pages are dropped
+void mem_cache_write(stm32_addr_t addr, uint32_t len, const uint8_t *src) {
+    while (len) {
+        stm32_addr_t base = addr & ~(MEM_CACHE_PAGE_SIZE - 1);
+        uint32_t offset = addr - base;
+        uint32_t size = MEM_CACHE_PAGE_SIZE - offset;
+        struct mem_cache_page *page = mem_cache_lookup(base);
+
+        if (size > len) { size = len; }
+
+        if (page != NULL && page->flash) {
+            page->valid = false;
+        } else if (page != NULL) {
+            memcpy(page->data + offset, src, size);
+        }
+
+        addr += size;
+        src += size;
+        len -= size;
+    }
+}
+
+void mem_cache_invalidate(bool keep_flash) {
+    for (uint32_t i = 0; i < MEM_CACHE_PAGES; i++) {
+        if (!keep_flash || !mem_cache[i].flash) { mem_cache[i].valid = false; }
+    }
+}
+
+void mem_cache_invalidate_flash(void) {
+    for (uint32_t i = 0; i < MEM_CACHE_PAGES; i++) {
+        if (mem_cache[i].flash) { mem_cache[i].valid = false; }
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef MEMORY_CACHE_H
+#define MEMORY_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <stlink.h>
+
+#define MEM_CACHE_PAGE_SIZE   1024
+#define MEM_CACHE_PAGES       128
+
+int32_t mem_cache_read(stlink_t *sl, stm32_addr_t addr, uint32_t len, uint8_t *dst);
+void mem_cache_write(stm32_addr_t addr, uint32_t len, const uint8_t *src);
+void mem_cache_invalidate(bool keep_flash);
+void mem_cache_invalidate_flash(void);
+
+#endif // MEMORY_CACHE_H
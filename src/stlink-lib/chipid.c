@@ -18,6 +18,10 @@
 // #include <ctype.h> // TODO: Check use
 // #include <errno.h> // TODO: Check use
 
+/*
+ * Filled by init_chipids() before any probe is opened and only read afterwards,
+ * so probes served by different threads may look up their chip concurrently
+ */
 static struct stlink_chipid_params *devicelist;
 
 void dump_a_chip(struct stlink_chipid_params *dev) {
@@ -25,6 +25,7 @@
 #include "logging.h"
 #include "map_file.h"
 #include "md5.h"
+#include "param_cache.h"
 #include "read_write.h"
 #include "register.h"
 #include "usb.h"
@@ -56,7 +57,6 @@ static void stop_wdg_in_debug(stlink_t *);
 int32_t stlink_jtag_reset(stlink_t *, int32_t);
 int32_t stlink_soft_reset(stlink_t *, int32_t);
 void _parse_version(stlink_t *, stlink_version_t *);
-static uint8_t stlink_parse_hex(const char *);
 static int32_t stlink_read(stlink_t *, stm32_addr_t, uint32_t, save_block_fn, void *);
 static bool stlink_fread_ihex_init(struct stlink_fread_ihex_worker_arg *, int32_t, stm32_addr_t);
 static bool stlink_fread_ihex_worker(void *, uint8_t *, ssize_t);
@@ -157,16 +157,16 @@ int32_t stlink_chip_id(stlink_t *sl, uint32_t *chip_id) {
   if ((sl->core_id == STM32_CORE_ID_M7F_M33_SWD || sl->core_id == STM32_CORE_ID_M7F_M33_JTAG) &&
       cpu_id.part == STLINK_REG_CMx_CPUID_PARTNO_CM7) {
     // STM32H7 chipid in 0x5c001000 (RM0433 pg3189)
-    ret = stlink_read_debug32(sl, 0x5c001000, chip_id);
+    sl->idcode_addr = 0x5c001000;
   } else if (cpu_id.part == STLINK_REG_CMx_CPUID_PARTNO_CM0 ||
              cpu_id.part == STLINK_REG_CMx_CPUID_PARTNO_CM0P) {
     // STM32F0 (RM0091, pg914; RM0360, pg713)
     // STM32L0 (RM0377, pg813; RM0367, pg915; RM0376, pg917)
     // STM32G0 (RM0444, pg1367)
-    ret = stlink_read_debug32(sl, 0x40015800, chip_id);
+    sl->idcode_addr = 0x40015800;
   } else if (cpu_id.part == STLINK_REG_CMx_CPUID_PARTNO_CM33) {
     // STM32L5 (RM0438, pg2157)
-    ret = stlink_read_debug32(sl, 0xE0044000, chip_id);
+    sl->idcode_addr = 0xE0044000;
   } else /* СM3, СM4, CM7 */ {
     // default chipid address
 
@@ -178,9 +178,12 @@ int32_t stlink_chip_id(stlink_t *sl, uint32_t *chip_id) {
     // STM32L4 (RM0351, pg1840; RM0394, pg1560)
     // STM32G4 (RM0440, pg2086)
     // STM32WB (RM0434, pg1406)
-    ret = stlink_read_debug32(sl, 0xE0042000, chip_id);
+    sl->idcode_addr = 0xE0042000;
   }
 
+  ret = stlink_read_debug32(sl, sl->idcode_addr, chip_id);
+  sl->idcode = *chip_id;
+
   if (ret || !(*chip_id)) {
     *chip_id = 0;
     ret = ret?ret:-1;
@@ -222,6 +225,37 @@ int32_t stlink_cpu_id(stlink_t *sl, cortex_m3_cpuid_t *cpuid) {
   return (0);
 }
 
+// flash size in bytes from the flash size register of the chip
+static uint32_t stlink_read_flash_size(stlink_t *sl, const struct stlink_chipid_params *params) {
+  uint32_t flash_size = 0;
+
+  stlink_read_debug32(sl, (params->flash_size_reg) & ~3, &flash_size);
+
+  if (params->flash_size_reg & 2) {
+    flash_size = flash_size >> 16;
+  }
+
+  flash_size = flash_size & 0xffff;
+
+  if ((sl->chip_id == STM32_CHIPID_L1_MD ||
+       sl->chip_id == STM32_CHIPID_F1_VL_MD_LD ||
+       sl->chip_id == STM32_CHIPID_L1_MD_PLUS) &&
+      (flash_size == 0)) {
+    return (128 * 1024);
+  } else if (sl->chip_id == STM32_CHIPID_L1_CAT2) {
+    return ((flash_size & 0xff) * 1024);
+  } else if ((sl->chip_id & 0xFFF) == STM32_CHIPID_L1_MD_PLUS_HD) {
+    // 0 is 384k and 1 is 256k
+    if (flash_size == 0) {
+      return (384 * 1024);
+    } else {
+      return (256 * 1024);
+    }
+  }
+
+  return (flash_size * 1024);
+}
+
 // 303
 /**
  * Reads and decodes the flash parameters, as dynamically as possible
@@ -234,7 +268,15 @@ int32_t stlink_load_device_params(stlink_t *sl) {
   DLOG("Loading device parameters....\n");
   const struct stlink_chipid_params *params = NULL;
   stlink_core_id(sl);
-  uint32_t flash_size;
+
+  // a cached target is confirmed by its IDCODE and, as parts of one chip id differ in it, its flash size
+  if (stlink_param_cache_load(sl) == 0 && (params = stlink_chipid_get_params(sl->chip_id)) != NULL) {
+    if (params->flash_type != STM32_FLASH_TYPE_UNKNOWN && stlink_read_flash_size(sl, params) == sl->flash_size) {
+      goto loaded;
+    }
+
+    DLOG("Flash size differs from the parameter cache\n");
+  }
 
   if (stlink_chip_id(sl, &sl->chip_id)) {
     return (-1);
@@ -256,31 +298,7 @@ int32_t stlink_load_device_params(stlink_t *sl) {
   // These are fixed...
   sl->flash_base = STM32_FLASH_BASE;
   sl->sram_base = STM32_SRAM_BASE;
-  stlink_read_debug32(sl, (params->flash_size_reg) & ~3, &flash_size);
-
-  if (params->flash_size_reg & 2) {
-    flash_size = flash_size >> 16;
-  }
-
-  flash_size = flash_size & 0xffff;
-
-  if ((sl->chip_id == STM32_CHIPID_L1_MD ||
-       sl->chip_id == STM32_CHIPID_F1_VL_MD_LD ||
-       sl->chip_id == STM32_CHIPID_L1_MD_PLUS) &&
-      (flash_size == 0)) {
-    sl->flash_size = 128 * 1024;
-  } else if (sl->chip_id == STM32_CHIPID_L1_CAT2) {
-    sl->flash_size = (flash_size & 0xff) * 1024;
-  } else if ((sl->chip_id & 0xFFF) == STM32_CHIPID_L1_MD_PLUS_HD) {
-    // 0 is 384k and 1 is 256k
-    if (flash_size == 0) {
-      sl->flash_size = 384 * 1024;
-    } else {
-      sl->flash_size = 256 * 1024;
-    }
-  } else {
-    sl->flash_size = flash_size * 1024;
-  }
+  sl->flash_size = stlink_read_flash_size(sl, params);
 
   sl->flash_type = params->flash_type;
   sl->flash_pgsz = params->flash_pagesize;
@@ -324,6 +342,12 @@ int32_t stlink_load_device_params(stlink_t *sl) {
       sl->chip_flags &= ~CHIP_F_HAS_DUAL_BANK;
   }
 
+  // the page size of these depends on option bytes, which may change between connections
+  if (sl->chip_id != STM32_CHIPID_G4_CAT3 && sl->chip_id != STM32_CHIPID_L5x2xx) {
+    stlink_param_cache_store(sl);
+  }
+
+loaded:
   ILOG("%s: %u KiB SRAM, %u KiB flash in at least %u %s pages.\n",
       params->dev_type, (sl->sram_size / 1024), (sl->flash_size / 1024),
       (sl->flash_pgsz < 1024) ? sl->flash_pgsz : (sl->flash_pgsz / 1024),
@@ -630,8 +654,6 @@ int32_t stlink_mwrite_sram(stlink_t *sl, uint8_t *data, uint32_t length, stm32_a
   // write the file in sram at addr
 
   int32_t error = -1;
-  uint32_t off;
-  uint32_t len;
 
   // check addr range is inside the sram
   if (addr < sl->sram_base) {
@@ -648,39 +670,59 @@ int32_t stlink_mwrite_sram(stlink_t *sl, uint8_t *data, uint32_t length, stm32_a
     goto on_error;
   }
 
-  len = length;
-
-  if (len & 3) {
-    len -= len & 3;
+  if (stlink_write_mem(sl, addr, length, data)) {
+    fprintf(stderr, "write to sram failed\n");
+    goto on_error;
   }
 
-  // do the copy by 1kB blocks
-  for (off = 0; off < len; off += 1024) {
-    uint32_t size = 1024;
+  error = 0; // success
+  stlink_fwrite_finalize(sl, addr);
 
-    if ((off + size) > len) {
-      size = len - off;
-    }
+on_error:
+  return (error);
+}
 
-    memcpy(sl->q_buf, data + off, size);
+/**
+ * Write segments to SRAM one by one, the gaps between them are left alone
+ * @param sl stlink context
+ * @param segs segments, e.g. from stlink_parse_ihex_segments()
+ * @param count number of segments
+ * @return 0 for success, -1 for failure
+ */
+int32_t stlink_write_sram_segments(stlink_t *sl, const stlink_segment_t *segs, uint32_t count) {
+  stm32_addr_t begin = UINT32_MAX;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (segs[i].addr < sl->sram_base ||
+        segs[i].addr + segs[i].len < segs[i].addr ||
+        segs[i].addr + segs[i].len > sl->sram_base + sl->sram_size) {
+      fprintf(stderr, "segment %#x+%u is outside of the sram\n", segs[i].addr, segs[i].len);
+      return (-1);
+    }
 
-    if (size & 3) {
-      size += 2;
-    } // round size if needed
+    if (segs[i].addr < begin) { begin = segs[i].addr; }
+  }
 
-    stlink_write_mem32(sl, addr + off, (uint16_t) size);
+  if (count == 0) {
+    fprintf(stderr, "no data to write\n");
+    return (-1);
   }
 
-  if (length > len) {
-    memcpy(sl->q_buf, data + len, length - len);
-    stlink_write_mem8(sl, addr + len, (uint16_t) (length - len));
+  // the lowest segment holds the vector table
+  if (begin & 3) {
+    fprintf(stderr, "unaligned addr\n");
+    return (-1);
   }
 
-  error = 0; // success
-  stlink_fwrite_finalize(sl, addr);
+  for (uint32_t i = 0; i < count; i++) {
+    if (segs[i].len && stlink_write_mem(sl, segs[i].addr, segs[i].len, segs[i].data)) {
+      fprintf(stderr, "write to sram failed\n");
+      return (-1);
+    }
+  }
 
-on_error:
-  return (error);
+  stlink_fwrite_finalize(sl, begin);
+  return (0);
 }
 
 //284
@@ -688,8 +730,6 @@ int32_t stlink_fwrite_sram(stlink_t *sl, const char *path, stm32_addr_t addr) {
   // write the file in sram at addr
 
   int32_t error = -1;
-  uint32_t off;
-  uint32_t len;
   mapped_file_t mf = MAPPED_FILE_INITIALIZER;
 
   if (map_file(&mf, path) == -1) {
@@ -716,32 +756,10 @@ int32_t stlink_fwrite_sram(stlink_t *sl, const char *path, stm32_addr_t addr) {
     goto on_error;
   }
 
-  len = mf.len;
-
-  if (len & 3) {
-    len -= len & 3;
-  }
-
-  // do the copy by 1kB blocks
-  for (off = 0; off < len; off += 1024) {
-    uint32_t size = 1024;
-
-    if ((off + size) > len) {
-      size = len - off;
-    }
-
-    memcpy(sl->q_buf, mf.base + off, size);
-
-    if (size & 3) {
-      size += 2;
-    } // round size if needed
-
-    stlink_write_mem32(sl, addr + off, (uint16_t) size);
-  }
-
-  if (mf.len > len) {
-    memcpy(sl->q_buf, mf.base + len, mf.len - len);
-    stlink_write_mem8(sl, addr + len, (uint16_t) (mf.len - len));
+  // the file is transferred straight from the mapping
+  if (stlink_write_mem(sl, addr, mf.len, mf.base)) {
+    fprintf(stderr, "write to sram failed\n");
+    goto on_error;
   }
 
   // check the file has been written
@@ -795,21 +813,7 @@ int32_t stlink_fread(stlink_t *sl, const char *path, bool is_ihex, stm32_addr_t
 // 300
 int32_t write_buffer_to_sram(stlink_t *sl, flash_loader_t *fl, const uint8_t *buf, uint16_t size) {
   // write the buffer right after the loader
-  int32_t ret = 0;
-  uint16_t chunk = size & ~0x3;
-  uint16_t rem = size & 0x3;
-
-  if (chunk) {
-    memcpy(sl->q_buf, buf, chunk);
-    ret = stlink_write_mem32(sl, fl->buf_addr, chunk);
-  }
-
-  if (rem && !ret) {
-    memcpy(sl->q_buf, buf + chunk, rem);
-    ret = stlink_write_mem8(sl, (fl->buf_addr) + chunk, rem);
-  }
-
-  return (ret);
+  return (stlink_write_mem(sl, fl->buf_addr, size, buf));
 }
 
 // 291
@@ -854,163 +858,572 @@ uint32_t stlink_calculate_pagesize(stlink_t *sl, uint32_t flashaddr) {
   return (sl->flash_pgsz);
 }
 
-// 279
-int32_t stlink_parse_ihex(const char *path, uint8_t erased_pattern, uint8_t **mem,
-                      uint32_t *size, uint32_t *begin) {
+// smallest power of two that holds n bytes, segment buffers grow by doubling
+static uint32_t ihex_capacity(uint32_t n) {
+  uint32_t cap = 256;
+
+  while (cap < n) { cap <<= 1; }
+
+  return (cap);
+}
+
+static int32_t segments_add_data(stlink_segment_t **segs, uint32_t *count, uint32_t addr,
+                               const uint8_t *data, uint32_t len) {
+  stlink_segment_t *seg = (*count) ? &(*segs)[*count - 1] : NULL;
+
+  // data that continues the last segment extends it
+  if (seg == NULL || seg->addr + seg->len != addr) {
+    stlink_segment_t *tmp = realloc(*segs, (*count + 1) * sizeof(stlink_segment_t));
+
+    if (!tmp) { return (-1); }
+
+    *segs = tmp;
+    seg = &tmp[(*count)++];
+    seg->addr = addr;
+    seg->len = 0;
+    seg->data = NULL;
+  }
+
+  if (seg->data == NULL || ihex_capacity(seg->len + len) != ihex_capacity(seg->len)) {
+    uint8_t *tmp = realloc(seg->data, ihex_capacity(seg->len + len));
+
+    if (!tmp) { return (-1); }
+
+    seg->data = tmp;
+  }
+
+  memcpy(seg->data + seg->len, data, len);
+  seg->len += len;
+  return (0);
+}
+
+void stlink_free_segments(stlink_segment_t *segs, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    free(segs[i].data);
+  }
+
+  free(segs);
+}
+
+/*
+ * Hex digit values with bit 4 set, 0 for characters that are not hex digits,
+ * so that a byte is decoded with two lookups and one validity check
+ */
+#define IHEX_DIGIT(c, v) [c] = 0x10 | (v)
+
+static const uint8_t ihex_digits[256] = {
+  IHEX_DIGIT('0', 0x0), IHEX_DIGIT('1', 0x1), IHEX_DIGIT('2', 0x2), IHEX_DIGIT('3', 0x3),
+  IHEX_DIGIT('4', 0x4), IHEX_DIGIT('5', 0x5), IHEX_DIGIT('6', 0x6), IHEX_DIGIT('7', 0x7),
+  IHEX_DIGIT('8', 0x8), IHEX_DIGIT('9', 0x9), IHEX_DIGIT('A', 0xA), IHEX_DIGIT('B', 0xB),
+  IHEX_DIGIT('C', 0xC), IHEX_DIGIT('D', 0xD), IHEX_DIGIT('E', 0xE), IHEX_DIGIT('F', 0xF),
+  IHEX_DIGIT('a', 0xA), IHEX_DIGIT('b', 0xB), IHEX_DIGIT('c', 0xC), IHEX_DIGIT('d', 0xD),
+  IHEX_DIGIT('e', 0xE), IHEX_DIGIT('f', 0xF),
+};
+
+// decode n hex byte pairs, returns false on a character that is not a hex digit
+static bool ihex_decode(const uint8_t *hex, uint8_t *out, uint32_t n) {
+  uint8_t valid = 0x10;
+
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t hi = ihex_digits[hex[2 * i]];
+    uint8_t lo = ihex_digits[hex[2 * i + 1]];
+
+    valid &= hi & lo;
+    out[i] = (uint8_t) ((hi << 4) | (lo & 0x0F));
+  }
+
+  return (valid != 0);
+}
+
+/**
+ * Parse an Intel HEX file into the blocks it contains
+ * @param path file to parse
+ * @param segs receives the segments in file order, free with stlink_free_segments()
+ * @param count receives the number of segments
+ * @return 0 for success, -1 for failure
+ */
+int32_t stlink_parse_ihex_segments(const char *path, stlink_segment_t **segs, uint32_t *count) {
+  mapped_file_t mf = MAPPED_FILE_INITIALIZER;
   int32_t res = 0;
-  *begin = UINT32_MAX;
-  uint8_t *data = NULL;
-  uint32_t end = 0;
   bool eof_found = false;
 
-  for (int32_t scan = 0; (res == 0) && (scan < 2); ++scan) {
-    // parse file two times - first to find memory range, second - to fill it
-    if (scan == 1) {
-      if (!eof_found) {
-        ELOG("No EoF recond\n");
-        res = -1;
-        break;
-      }
+  *segs = NULL;
+  *count = 0;
 
-      if (*begin >= end) {
-        ELOG("No data found in file\n");
-        res = -1;
-        break;
-      }
+  // the file is parsed in one pass straight from the mapping
+  if (map_file(&mf, path) == -1) {
+    ELOG("Cannot open file\n");
+    return (-1);
+  }
 
-      *size = (end - *begin) + 1;
-      data = calloc(1, *size); // use calloc to get NULL if out of memory
+  const uint8_t *p = mf.base;
+  const uint8_t *end = mf.base + mf.len;
+  uint32_t lba = 0;
+  uint8_t rec[5 + 255];
 
-      if (!data) {
-        ELOG("Cannot allocate %u bytes\n", (*size));
-        res = -1;
-        break;
-      }
+  while (p < end) {
+    const uint8_t *eol = memchr(p, '\n', (size_t) (end - p));
+    const uint8_t *line = p;
+
+    if (eol == NULL) { eol = end; }
+
+    p = (eol < end) ? eol + 1 : end;
 
-      memset(data, erased_pattern, *size);
+    uint32_t l = (uint32_t) (eol - line);
+
+    while (l > 0 && line[l - 1] == '\r') {
+      --l;
+    } // trim EoL
+
+    if (l == 0) {
+      continue;
+    } // skip empty lines
+
+    if (line[0] != ':') { // no marker - wrong file format
+      ELOG("Wrong file format - no marker\n");
+      res = -1;
+      break;
     }
 
-    FILE *file = fopen(path, "r");
+    if ((l < 11) || (l > sizeof(rec) * 2 + 1) || !(l & 1)) { // line too short or long - wrong file format
+      ELOG("Wrong file format - wrong line length\n");
+      res = -1;
+      break;
+    }
+
+    uint32_t n = (l - 1) / 2;
 
-    if (!file) {
-      ELOG("Cannot open file\n");
+    if (!ihex_decode(line + 1, rec, n)) {
+      ELOG("Wrong file format - invalid hex digit\n");
       res = -1;
       break;
     }
 
-    uint32_t lba = 0;
-    char line[1 + 5 * 2 + 255 * 2 + 2];
+    uint8_t chksum = 0; // check sum
 
-    while (fgets(line, sizeof(line), file)) {
-      if (line[0] == '\n' || line[0] == '\r') {
-        continue;
-      } // skip empty lines
+    for (uint32_t i = 0; i < n; i++) {
+      chksum += rec[i];
+    }
 
-      if (line[0] != ':') { // no marker - wrong file format
-        ELOG("Wrong file format - no marker\n");
-        res = -1;
-        break;
-      }
+    if (chksum != 0) {
+      ELOG("Wrong file format - checksum mismatch\n");
+      res = -1;
+      break;
+    }
 
-      uint32_t l = (uint32_t) strlen(line);
+    uint8_t reclen = rec[0];
 
-      while (l > 0 && (line[l - 1] == '\n' || line[l - 1] == '\r')) {
-        --l;
-      } // trim EoL
+    if ((uint32_t) reclen + 5 != n) {
+      ELOG("Wrong file format - record length mismatch\n");
+      res = -1;
+      break;
+    }
+
+    uint16_t offset = ((uint16_t) rec[1] << 8) | ((uint16_t) rec[2]);
+    uint8_t rectype = rec[3];
 
-      if ((l < 11) ||
-          (l ==
-           (sizeof(line) - 1))) { // line too short or long - wrong file format
-        ELOG("Wrong file format - wrong line length\n");
+    switch (rectype) {
+    case 0: /* Data */
+      if (reclen && segments_add_data(segs, count, lba + offset, rec + 4, reclen)) {
+        ELOG("Cannot allocate memory for segment at %#x\n", lba + offset);
+        res = -1;
+      }
+      break;
+    case 1: /* EoF */
+      eof_found = true;
+      break;
+    case 2: /* Extended Segment Address, unexpected */
+      res = -1;
+      break;
+    case 3: /* Start Segment Address, unexpected */
+      res = -1;
+      break;
+    case 4: /* Extended Linear Address */
+      if (reclen == 2) {
+        lba = ((uint32_t) rec[4] << 24) | ((uint32_t) rec[5] << 16);
+      } else {
+        ELOG("Wrong file format - wrong LBA length\n");
         res = -1;
-        break;
       }
+      break;
+    case 5: /* Start Linear Address - expected, but ignore */
+      break;
+    default:
+      ELOG("Wrong file format - unexpected record type %d\n", rectype);
+      res = -1;
+    }
 
-      uint8_t chksum = 0; // check sum
+    if (res != 0) {
+      break;
+    }
+  }
 
-      for (uint32_t i = 1; i < l; i += 2) {
-        chksum += stlink_parse_hex(line + i);
-      }
+  unmap_file(&mf);
 
-      if (chksum != 0) {
-        ELOG("Wrong file format - checksum mismatch\n");
-        res = -1;
-        break;
-      }
+  if (res == 0 && !eof_found) {
+    ELOG("No EoF recond\n");
+    res = -1;
+  } else if (res == 0 && *count == 0) {
+    ELOG("No data found in file\n");
+    res = -1;
+  }
 
-      uint8_t reclen = stlink_parse_hex(line + 1);
+  if (res != 0) {
+    stlink_free_segments(*segs, *count);
+    *segs = NULL;
+    *count = 0;
+  }
 
-      if (((uint32_t) reclen + 5) * 2 + 1 != l) {
-        ELOG("Wrong file format - record length mismatch\n");
-        res = -1;
-        break;
-      }
+  return (res);
+}
 
-      uint16_t offset = ((uint16_t) stlink_parse_hex(line + 3) << 8) |
-                        ((uint16_t) stlink_parse_hex(line + 5));
-      uint8_t rectype = stlink_parse_hex(line + 7);
-
-      switch (rectype) {
-      case 0: /* Data */
-        if (scan == 0) {
-          uint32_t b = lba + offset;
-          uint32_t e = b + reclen - 1;
-
-          if (b < *begin) {
-            *begin = b;
-          }
-
-          if (e > end) {
-            end = e;
-          }
-        } else {
-          for (uint8_t i = 0; i < reclen; ++i) {
-            uint8_t b = stlink_parse_hex(line + 9 + i * 2);
-            uint32_t addr = lba + offset + i;
-
-            if (addr >= *begin && addr <= end) {
-              data[addr - *begin] = b;
-            }
-          }
-        }
-        break;
-      case 1: /* EoF */
-        eof_found = true;
-        break;
-      case 2: /* Extended Segment Address, unexpected */
-        res = -1;
-        break;
-      case 3: /* Start Segment Address, unexpected */
-        res = -1;
-        break;
-      case 4: /* Extended Linear Address */
-        if (reclen == 2) {
-          lba = ((uint32_t) stlink_parse_hex(line + 9) << 24) |
-                ((uint32_t) stlink_parse_hex(line + 11) << 16);
-        } else {
-          ELOG("Wrong file format - wrong LBA length\n");
-          res = -1;
-        }
-        break;
-      case 5: /* Start Linear Address - expected, but ignore */
-        break;
-      default:
-        ELOG("Wrong file format - unexpected record type %d\n", rectype);
-        res = -1;
-      }
+/**
+ * Copy segments into one buffer spanning all of them, gaps filled with a pattern
+ * @param segs segments, later ones win where they overlap
+ * @param count number of segments
+ * @param fill value for the gaps
+ * @param mem receives the allocated buffer
+ * @param size receives the buffer size
+ * @param begin receives the address of the first byte
+ * @return 0 for success, -1 for failure
+ */
+int32_t stlink_segments_flatten(const stlink_segment_t *segs, uint32_t count, uint8_t fill,
+                                uint8_t **mem, uint32_t *size, uint32_t *begin) {
+  uint32_t end = 0;
+  uint8_t *data;
+
+  *begin = UINT32_MAX;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (segs[i].addr < *begin) { *begin = segs[i].addr; }
+
+    if (segs[i].addr + segs[i].len - 1 > end) { end = segs[i].addr + segs[i].len - 1; }
+  }
+
+  if (*begin > end) {
+    ELOG("No data found in file\n");
+    return (-1);
+  }
+
+  *size = (end - *begin) + 1;
+  data = calloc(1, *size); // use calloc to get NULL if out of memory
+
+  if (!data) {
+    ELOG("Cannot allocate %u bytes\n", (*size));
+    return (-1);
+  }
+
+  memset(data, fill, *size);
+
+  for (uint32_t i = 0; i < count; i++) {
+    memcpy(data + (segs[i].addr - *begin), segs[i].data, segs[i].len);
+  }
+
+  *mem = data;
+  return (0);
+}
+
+// 279
+int32_t stlink_parse_ihex(const char *path, uint8_t erased_pattern, uint8_t **mem,
+                      uint32_t *size, uint32_t *begin) {
+  stlink_segment_t *segs;
+  uint32_t count;
+  int32_t res = stlink_parse_ihex_segments(path, &segs, &count);
+
+  if (res == 0) {
+    res = stlink_segments_flatten(segs, count, erased_pattern, mem, size, begin);
+    stlink_free_segments(segs, count);
+  }
+
+  return (res);
+}
+
+/* ELF32 fields used to find the loadable segments */
+#define ELF_EI_CLASS      4
+#define ELF_EI_DATA       5
+#define ELF_CLASS32       1
+#define ELF_DATA2LSB      1
+#define ELF_EM_ARM        40
+#define ELF_PT_LOAD       1
+#define ELF32_EHDR_SIZE   52
+#define ELF32_PHDR_SIZE   32
+
+/**
+ * Collect the loadable segments of an ELF file
+ * @param path ELF file, 32-bit little endian ARM
+ * @param segs receives one segment per PT_LOAD with file data, at its load address
+ * @param count receives the number of segments
+ * @return 0 for success, -1 for failure
+ */
+int32_t stlink_parse_elf_segments(const char *path, stlink_segment_t **segs, uint32_t *count) {
+  mapped_file_t mf = MAPPED_FILE_INITIALIZER;
+  int32_t res = 0;
+
+  *segs = NULL;
+  *count = 0;
+
+  if (map_file(&mf, path) == -1) {
+    ELOG("Cannot open file\n");
+    return (-1);
+  }
+
+  const uint8_t *base = mf.base;
+
+  if (mf.len < ELF32_EHDR_SIZE || memcmp(base, "\177ELF", 4) ||
+      base[ELF_EI_CLASS] != ELF_CLASS32 || base[ELF_EI_DATA] != ELF_DATA2LSB) {
+    ELOG("Not a 32-bit little endian ELF file\n");
+    unmap_file(&mf);
+    return (-1);
+  }
+
+  uint32_t phoff = read_uint32(base, 28);
+  uint32_t phentsize = read_uint16(base, 42);
+  uint32_t phnum = read_uint16(base, 44);
+
+  if (read_uint16(base, 18) != ELF_EM_ARM) {
+    ELOG("ELF file is not for ARM\n");
+    res = -1;
+  } else if (phentsize < ELF32_PHDR_SIZE || phoff > mf.len ||
+             (uint64_t) phnum * phentsize > mf.len - phoff) {
+    ELOG("Wrong ELF file - program headers out of file\n");
+    res = -1;
+  }
+
+  for (uint32_t i = 0; res == 0 && i < phnum; i++) {
+    const uint8_t *ph = base + phoff + i * phentsize;
+    uint32_t offset = read_uint32(ph, 4);
+    uint32_t paddr = read_uint32(ph, 12);
+    uint32_t filesz = read_uint32(ph, 16);
+
+    // only the file contents are written, the zero filled rest (NOBITS) is up to the startup code
+    if (read_uint32(ph, 0) != ELF_PT_LOAD || filesz == 0) {
+      continue;
+    }
+
+    if (offset > mf.len || filesz > mf.len - offset) {
+      ELOG("Wrong ELF file - segment %u out of file\n", i);
+      res = -1;
+    } else if (segments_add_data(segs, count, paddr, base + offset, filesz)) {
+      ELOG("Cannot allocate memory for segment at %#x\n", paddr);
+      res = -1;
+    } else {
+      DLOG("ELF segment %u: %u bytes at %#x (vaddr %#x)\n", i, filesz, paddr, read_uint32(ph, 8));
+    }
+  }
+
+  unmap_file(&mf);
 
-      if (res != 0) {
+  if (res == 0 && *count == 0) {
+    ELOG("No loadable data found in file\n");
+    res = -1;
+  }
+
+  if (res != 0) {
+    stlink_free_segments(*segs, *count);
+    *segs = NULL;
+    *count = 0;
+  }
+
+  return (res);
+}
+
+/* One image of a manifest, filled in from the keys of its [section] */
+struct manifest_image {
+  char file[512];
+  char format[16];
+  char address[32];
+  uint32_t line;
+};
+
+// strip leading and trailing white space in place
+static char *manifest_trim(char *s) {
+  char *e;
+
+  while (*s == ' ' || *s == '\t') { s++; }
+
+  e = s + strlen(s);
+
+  while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' || e[-1] == '\n')) { e--; }
+
+  *e = '\0';
+  return (s);
+}
+
+// Unix, Windows drive and UNC paths (/fw, C:\fw, \\server\fw) are not relative to the manifest
+static bool manifest_path_absolute(const char *file) {
+  if (file[0] == '/' || file[0] == '\\') { return (true); }
+
+  return (((file[0] >= 'A' && file[0] <= 'Z') || (file[0] >= 'a' && file[0] <= 'z')) && file[1] == ':');
+}
+
+static int32_t manifest_load_image(const char *manifest, const struct manifest_image *img,
+                                   stlink_segment_t **segs, uint32_t *count) {
+  stlink_segment_t *part = NULL, *tmp;
+  uint32_t nparts = 0;
+  char path[1024];
+  const char *slash = strrchr(manifest, '/');
+  int32_t res;
+
+  if (strrchr(manifest, '\\') > slash) { slash = strrchr(manifest, '\\'); }
+
+  if (img->file[0] == '\0') {
+    ELOG("Manifest image at line %u has no file\n", img->line);
+    return (-1);
+  }
+
+  // relative paths are taken from the directory of the manifest
+  if (manifest_path_absolute(img->file) || slash == NULL) {
+    snprintf(path, sizeof(path), "%s", img->file);
+  } else {
+    snprintf(path, sizeof(path), "%.*s/%s", (int32_t)(slash - manifest), manifest, img->file);
+  }
+
+  if (strcmp(img->format, "ihex") == 0) {
+    res = stlink_parse_ihex_segments(path, &part, &nparts);
+  } else if (strcmp(img->format, "elf") == 0) {
+    res = stlink_parse_elf_segments(path, &part, &nparts);
+  } else if (img->format[0] == '\0' || strcmp(img->format, "binary") == 0) {
+    mapped_file_t mf = MAPPED_FILE_INITIALIZER;
+    char *tail;
+    uint32_t addr = (uint32_t) strtoul(img->address, &tail, 0);
+
+    if (img->address[0] == '\0' || *tail != '\0') {
+      ELOG("Manifest image at line %u needs an address for a binary file\n", img->line);
+      return (-1);
+    }
+
+    if (map_file(&mf, path) == -1) {
+      ELOG("Cannot open file %s\n", path);
+      return (-1);
+    }
+
+    res = (mf.len == 0) ? -1 : segments_add_data(&part, &nparts, addr, mf.base, (uint32_t) mf.len);
+    unmap_file(&mf);
+  } else {
+    ELOG("Manifest image at line %u has unknown format '%s'\n", img->line, img->format);
+    return (-1);
+  }
+
+  if (res != 0) {
+    ELOG("Cannot load %s from manifest line %u\n", path, img->line);
+    stlink_free_segments(part, nparts);
+    return (-1);
+  }
+
+  tmp = realloc(*segs, (*count + nparts) * sizeof(stlink_segment_t));
+
+  if (!tmp) {
+    stlink_free_segments(part, nparts);
+    return (-1);
+  }
+
+  memcpy(tmp + *count, part, nparts * sizeof(stlink_segment_t));
+  free(part);
+  *segs = tmp;
+  *count += nparts;
+  ILOG("Manifest: %s, %u segment(s)\n", path, nparts);
+  return (0);
+}
+
+/**
+ * Collect the segments of all images listed in a manifest file
+ *
+ * The manifest is an INI file with one section per image:
+ *   [bootloader]
+ *   file = boot.bin
+ *   format = binary
+ *   address = 0x08000000
+ * format is one of binary (default), ihex or elf, address is needed for binary files only.
+ * Relative file names are taken from the directory of the manifest.
+ * Lines starting with '#' or ';' are comments.
+ * @param path manifest file
+ * @param segs receives the segments of all images
+ * @param count receives the number of segments
+ * @return 0 for success, -1 for failure or when images overlap
+ */
+int32_t stlink_parse_manifest_segments(const char *path, stlink_segment_t **segs, uint32_t *count) {
+  struct manifest_image img;
+  bool in_image = false;
+  char line[1024];
+  uint32_t lineno = 0;
+  int32_t res = 0;
+  FILE *f = fopen(path, "r");
+
+  *segs = NULL;
+  *count = 0;
+
+  if (f == NULL) {
+    ELOG("Cannot open manifest %s\n", path);
+    return (-1);
+  }
+
+  while (res == 0) {
+    bool eof = (fgets(line, sizeof(line), f) == NULL);
+    char *s = eof ? NULL : manifest_trim(line);
+
+    lineno++;
+
+    if (!eof && (*s == '\0' || *s == '#' || *s == ';')) { continue; }
+
+    // a new section or the end of the file completes the previous image
+    if (eof || *s == '[') {
+      if (in_image) { res = manifest_load_image(path, &img, segs, count); }
+
+      if (eof) { break; }
+
+      memset(&img, 0, sizeof(img));
+      img.line = lineno;
+      in_image = true;
+      continue;
+    }
+
+    char *eq = strchr(s, '=');
+
+    if (!in_image || eq == NULL) {
+      ELOG("Manifest line %u: expected [section] or key = value\n", lineno);
+      res = -1;
+      break;
+    }
+
+    *eq = '\0';
+    char *key = manifest_trim(s);
+    char *value = manifest_trim(eq + 1);
+
+    if (strcmp(key, "file") == 0) {
+      snprintf(img.file, sizeof(img.file), "%s", value);
+    } else if (strcmp(key, "format") == 0) {
+      snprintf(img.format, sizeof(img.format), "%s", value);
+    } else if (strcmp(key, "address") == 0) {
+      snprintf(img.address, sizeof(img.address), "%s", value);
+    } else {
+      ELOG("Manifest line %u: unknown key '%s'\n", lineno, key);
+      res = -1;
+    }
+  }
+
+  fclose(f);
+
+  // images must not overwrite each other
+  for (uint32_t i = 0; res == 0 && i < *count; i++) {
+    for (uint32_t j = i + 1; j < *count; j++) {
+      if ((*segs)[i].addr < (*segs)[j].addr + (*segs)[j].len &&
+          (*segs)[j].addr < (*segs)[i].addr + (*segs)[i].len) {
+        ELOG("Manifest images overlap at %#x and %#x\n", (*segs)[i].addr, (*segs)[j].addr);
+        res = -1;
         break;
       }
     }
+  }
 
-    fclose(file);
+  if (res == 0 && *count == 0) {
+    ELOG("No images found in manifest\n");
+    res = -1;
   }
 
-  if (res == 0) {
-    *mem = data;
-  } else {
-    free(data);
+  if (res != 0) {
+    stlink_free_segments(*segs, *count);
+    *segs = NULL;
+    *count = 0;
   }
 
   return (res);
@@ -1187,8 +1600,21 @@ void _parse_version(stlink_t *sl, stlink_version_t *slv) {
     sl->version.flags |= STLINK_F_HAS_GETLASTRWSTATUS2;
     sl->version.flags |= STLINK_F_HAS_TRACE;
     sl->max_trace_freq = STLINK_V3_MAX_TRACE_FREQUENCY;
+
+    // 8 bit read/write max packet size 512 bytes from V3J6
+    if (sl->version.jtag_v >= 6) {
+      sl->version.flags |= STLINK_F_HAS_RW8_512BYTES;
+    }
   }
 
+  // transfer limits of a plain one command per block transport,
+  // backends able to split and pipeline large blocks raise block_size
+  sl->xfer_caps.max_rw8 = (sl->version.flags & STLINK_F_HAS_RW8_512BYTES) ?
+      STLINK_V3_MAX_RW8 : STLINK_V2_MAX_RW8;
+  sl->xfer_caps.rw32_cmd_size = (slv->jtag_api == STLINK_JTAG_API_V3) ?
+      STLINK_V3_RW32_CMD_SIZE : STLINK_V2_RW32_CMD_SIZE;
+  sl->xfer_caps.block_size = STLINK_BLOCK_SIZE_SYNC;
+
   return;
 }
 
@@ -1213,7 +1639,7 @@ static int32_t stlink_read(stlink_t *sl, stm32_addr_t addr, uint32_t size, save_
     size = sl->flash_size;
   }
 
-  uint32_t cmp_size = (sl->flash_pgsz > 0x1800) ? 0x1800 : sl->flash_pgsz;
+  uint32_t cmp_size = sl->xfer_caps.block_size;
 
   for (uint32_t off = 0; off < size; off += cmp_size) {
     uint32_t aligned_size;
@@ -1253,27 +1679,6 @@ static bool stlink_fread_worker(void *arg, uint8_t *block, ssize_t len) {
   }
 }
 
-// TODO: length not checked
-static uint8_t stlink_parse_hex(const char *hex) {
-  uint8_t d[2];
-
-  for (int32_t i = 0; i < 2; ++i) {
-    char c = *(hex + i);
-
-    if (c >= '0' && c <= '9') {
-      d[i] = c - '0';
-    } else if (c >= 'A' && c <= 'F') {
-      d[i] = c - 'A' + 10;
-    } else if (c >= 'a' && c <= 'f') {
-      d[i] = c - 'a' + 10;
-    } else {
-      return (0); // error
-    }
-  }
-
-  return ((d[0] << 4) | (d[1]));
-}
-
 static bool stlink_fread_ihex_newsegment(struct stlink_fread_ihex_worker_arg *the_arg) {
   uint32_t addr = the_arg->addr;
   uint8_t sum = 2 + 4 + (uint8_t) ((addr & 0xFF000000) >> 24) +
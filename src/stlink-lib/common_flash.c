@@ -7,6 +7,7 @@
 #include <stdint.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -15,6 +16,8 @@
 
 #include "calculate.h"
 #include "flash_loader.h"
+#include "flash_poll.h"
+#include "helper.h"
 #include "logging.h"
 #include "map_file.h"
 #include "md5.h"
@@ -287,10 +290,17 @@ uint32_t is_flash_busy(stlink_t *sl) {
   return (res);
 }
 
+static bool is_flash_idle(stlink_t *sl) {
+  return (is_flash_busy(sl) == 0);
+}
+
 void wait_flash_busy(stlink_t *sl) {
-  // TODO: add some delays here
-  while (is_flash_busy(sl))
-    ;
+  stlink_poll_wait(sl, STLINK_POLL_OTHER, 0, is_flash_idle, 0);
+}
+
+// wait for an operation with a learned duration, size is the bytes it affects
+void wait_flash_busy_op(stlink_t *sl, enum stlink_poll_op op, uint32_t size) {
+  stlink_poll_wait(sl, op, size, is_flash_idle, 0);
 }
 
 int32_t check_flash_error(stlink_t *sl) {
@@ -491,11 +501,12 @@ static void unlock_flash(stlink_t *sl) {
     return;
   }
 
-  stlink_write_debug32(sl, key_reg, flash_key1);
-  stlink_write_debug32(sl, key_reg, flash_key2);
+  // the keys must arrive in order, so they are not queued
+  if (stlink_write_debug32(sl, key_reg, flash_key1) == 0) {
+    stlink_write_debug32(sl, key_reg, flash_key2);
+  }
 
-  if (key2_reg) {
-    stlink_write_debug32(sl, key2_reg, flash_key1);
+  if (key2_reg && stlink_write_debug32(sl, key2_reg, flash_key1) == 0) {
     stlink_write_debug32(sl, key2_reg, flash_key2);
   }
 }
@@ -705,12 +716,16 @@ static int32_t unlock_flash_option(stlink_t *sl) {
     return (-1);
   }
 
-  stlink_write_debug32(sl, optkey_reg, optkey1);
-  stlink_write_debug32(sl, optkey_reg, optkey2);
+  // the keys must arrive in order, so they are not queued
+  if (stlink_write_debug32(sl, optkey_reg, optkey1) ||
+      stlink_write_debug32(sl, optkey_reg, optkey2)) {
+    return (-1);
+  }
 
-  if (optkey2_reg) {
-    stlink_write_debug32(sl, optkey2_reg, optkey1);
-    stlink_write_debug32(sl, optkey2_reg, optkey2);
+  if (optkey2_reg &&
+      (stlink_write_debug32(sl, optkey2_reg, optkey1) ||
+       stlink_write_debug32(sl, optkey2_reg, optkey2))) {
+    return (-1);
   }
 
   return (0);
@@ -804,10 +819,6 @@ static void wait_flash_busy_progress(stlink_t *sl) {
   fprintf(stdout, "\n");
 }
 
-static inline void write_flash_ar(stlink_t *sl, uint32_t n, uint32_t bank) {
-  stlink_write_debug32(sl, (bank == BANK_1) ? FLASH_AR : FLASH_AR2, n);
-}
-
 static inline void write_flash_cr_snb(stlink_t *sl, uint32_t n, uint32_t bank) {
   uint32_t cr_reg, snb_mask, snb_shift, ser_shift;
   uint32_t x = read_flash_cr(sl, bank);
@@ -998,6 +1009,11 @@ static void set_flash_cr_mer(stlink_t *sl, bool v, uint32_t bank) {
  * @return 0 on success -ve on failure
  */
 int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
+  // page erased flash takes only standard programming
+  sl->flash_mass_erased = false;
+
+  uint32_t page_size = stlink_calculate_pagesize(sl, flashaddr);
+
   // wait for ongoing op to finish
   wait_flash_busy(sl);
   // clear flash IO errors
@@ -1043,7 +1059,8 @@ int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
     }
 
     set_flash_cr_strt(sl, BANK_1); // start erase operation
-    wait_flash_busy(sl);           // wait for completion
+    wait_flash_busy_op(sl, (sl->flash_type == STM32_FLASH_TYPE_L4) ?
+                       STLINK_POLL_PAGE_ERASE : STLINK_POLL_SECTOR_ERASE, page_size); // wait for completion
     lock_flash(sl);                // TODO: fails to program if this is in
 #if DEBUG_FLASH
     fprintf(stdout, "Erase Final CR:0x%x\n", read_flash_cr(sl, BANK_1));
@@ -1094,7 +1111,7 @@ int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
      * Test shows that a few iterations is performed in the following loop
      * before busy bit is cleared.
      */
-    wait_flash_busy(sl);
+    wait_flash_busy_op(sl, STLINK_POLL_PAGE_ERASE, page_size);
 
     // reset lock bits
     stlink_read_debug32(sl, flash_regs_base + FLASH_PECR_OFF, &val);
@@ -1176,18 +1193,28 @@ int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
     }
 
     set_flash_cr_strt(sl, BANK_1);  // set the 'start operation' bit
-    wait_flash_busy(sl);            // wait for the 'busy' bit to clear
+    wait_flash_busy_op(sl, STLINK_POLL_PAGE_ERASE, page_size); // wait for the 'busy' bit to clear
     clear_flash_cr_per(sl, BANK_1); // clear the 'enable page erase' bit
     lock_flash(sl);
   } else if (sl->flash_type == STM32_FLASH_TYPE_F0_F1_F3 ||
              sl->flash_type == STM32_FLASH_TYPE_F1_XL) {
     uint32_t bank = (flashaddr < STM32_F1_FLASH_BANK2_BASE) ? BANK_1 : BANK_2;
+    uint32_t cr_reg = (bank == BANK_1) ? FLASH_CR : FLASH_CR2;
     unlock_flash_if(sl);
-    clear_flash_cr_pg(sl, bank);         // clear the pg bit
-    set_flash_cr_per(sl, bank);          // set the page erase bit
-    write_flash_ar(sl, flashaddr, bank); // select the page to erase
-    set_flash_cr_strt(sl, bank); // start erase operation, reset by hw with busy bit
-    wait_flash_busy(sl);
+
+    // each step must have taken effect before the next, STRT must not erase a stale AR
+    uint32_t cr = read_flash_cr(sl, bank) & ~(1 << FLASH_CR_PG);
+
+    if (stlink_write_debug32(sl, cr_reg, cr) ||                         // clear the pg bit
+        stlink_write_debug32(sl, cr_reg, cr | (1 << FLASH_CR_PER)) ||  // set the page erase bit
+        stlink_write_debug32(sl, (bank == BANK_1) ? FLASH_AR : FLASH_AR2, flashaddr) || // select the page to erase
+        stlink_write_debug32(sl, cr_reg, cr | (1 << FLASH_CR_PER) | (1 << FLASH_CR_STRT))) { // start erase operation, reset by hw with busy bit
+      lock_flash(sl);
+      WLOG("erase setup failed for page %#x\n", flashaddr);
+      return (-1);
+    }
+
+    wait_flash_busy_op(sl, STLINK_POLL_PAGE_ERASE, page_size);
     clear_flash_cr_per(sl, bank); // clear the page erase bit
     lock_flash(sl);
   } else if (sl->flash_type == STM32_FLASH_TYPE_H7) {
@@ -1196,7 +1223,7 @@ int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
     uint32_t sector = calculate_H7_sectornum(sl, flashaddr, bank); // calculate the actual page from the address
     write_flash_cr_snb(sl, sector, bank); // select the page to erase
     set_flash_cr_strt(sl, bank);          // start erase operation
-    wait_flash_busy(sl);                  // wait for completion
+    wait_flash_busy_op(sl, STLINK_POLL_SECTOR_ERASE, page_size); // wait for completion
     lock_flash(sl);
   } else {
     WLOG("unknown coreid %x, page erase failed\n", sl->core_id);
@@ -1206,6 +1233,181 @@ int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
   return check_flash_error(sl);
 }
 
+/**
+ * Check whether a flash page already holds the erased pattern
+ * @param sl stlink context
+ * @param addr page start address
+ * @param size page size
+ * @return true if erasing the page can be skipped
+ */
+bool stlink_is_page_erased(stlink_t *sl, stm32_addr_t addr, uint32_t size) {
+  uint32_t off, n = sl->xfer_caps.block_size;
+  uint8_t erased = stlink_get_erased_pattern(sl);
+  uint8_t *pattern, *buf;
+  bool ret = true;
+  int32_t crc;
+
+  /*
+   * A word programmed with the erased value reads back like an erased one.
+   * Parts with ECC flash cannot program such a word again, so only the
+   * families without ECC are checked.
+   */
+  if (sl->flash_type != STM32_FLASH_TYPE_F0_F1_F3 &&
+      sl->flash_type != STM32_FLASH_TYPE_F1_XL &&
+      sl->flash_type != STM32_FLASH_TYPE_F2_F4 &&
+      sl->flash_type != STM32_FLASH_TYPE_F7) {
+    return (false);
+  }
+
+  pattern = malloc(size);
+  buf = malloc(n);
+
+  if (pattern == NULL || buf == NULL) {
+    free(pattern);
+    free(buf);
+    return (false);
+  }
+
+  memset(pattern, erased, size);
+  crc = stlink_flash_loader_verify_crc32(sl, addr, pattern, size);
+
+  if (crc != -1) {
+    ret = (crc == 0);
+  } else {
+    // the on-target check is not available, read the page back instead
+    for (off = 0; off < size && ret; off += n) {
+      uint32_t cmp_size = (size - off > n) ? n : size - off;
+
+      ret = stlink_read_mem(sl, addr + off, cmp_size, buf) == 0 &&
+            memcmp(buf, pattern, cmp_size) == 0;
+    }
+  }
+
+  free(pattern);
+  free(buf);
+  return (ret);
+}
+
+/*
+ * F1_XL and dual bank H7 have a flash controller per bank, so a page can be
+ * erased on each bank at the same time. The section erase keeps both banks
+ * busy and only waits when neither of them can take the next page.
+ */
+static stm32_addr_t flash_bank2_base(stlink_t *sl) {
+  if (sl->flash_type == STM32_FLASH_TYPE_F1_XL) {
+    return (STM32_F1_FLASH_BANK2_BASE);
+  } else if (sl->flash_type == STM32_FLASH_TYPE_H7 && sl->chip_flags & CHIP_F_HAS_DUAL_BANK) {
+    return (STM32_H7_FLASH_BANK2_BASE);
+  }
+
+  return (0);
+}
+
+static bool is_flash_bank_busy(stlink_t *sl, uint32_t bank) {
+  uint32_t busy = (sl->flash_type == STM32_FLASH_TYPE_H7) ? (1 << FLASH_H7_SR_QW) : (1 << FLASH_SR_BSY);
+  return ((read_flash_sr(sl, bank) & busy) != 0);
+}
+
+static bool is_flash_bank_idle(stlink_t *sl, void *arg) {
+  return (!is_flash_bank_busy(sl, *(uint32_t *) arg));
+}
+
+static int32_t start_flash_bank_erase(stlink_t *sl, stm32_addr_t addr, uint32_t bank) {
+  if (sl->flash_type == STM32_FLASH_TYPE_H7) {
+    write_flash_cr_snb(sl, calculate_H7_sectornum(sl, addr, bank), bank);
+    set_flash_cr_strt(sl, bank);
+    return (0);
+  }
+
+  uint32_t cr_reg = (bank == BANK_1) ? FLASH_CR : FLASH_CR2;
+  uint32_t cr = (read_flash_cr(sl, bank) & ~(1 << FLASH_CR_PG)) | (1 << FLASH_CR_PER);
+
+  // in order and stopping at a failure, STRT must not erase a stale AR
+  if (stlink_write_debug32(sl, cr_reg, cr) ||
+      stlink_write_debug32(sl, (bank == BANK_1) ? FLASH_AR : FLASH_AR2, addr) ||
+      stlink_write_debug32(sl, cr_reg, cr | (1 << FLASH_CR_STRT))) {
+    return (-1);
+  }
+
+  return (0);
+}
+
+static int32_t stlink_erase_flash_section_dual(stlink_t *sl, stm32_addr_t base_addr, uint32_t size) {
+  stm32_addr_t bank2 = flash_bank2_base(sl);
+  stm32_addr_t end = base_addr + size;
+  stm32_addr_t next[2], stop[2], cur[2];
+  uint32_t cur_size[2], started[2];
+  bool busy[2] = { false, false };
+  enum stlink_poll_op op = (sl->flash_type == STM32_FLASH_TYPE_H7) ?
+                           STLINK_POLL_SECTOR_ERASE : STLINK_POLL_PAGE_ERASE;
+  int32_t ret = 0;
+  uint32_t bank;
+
+  next[BANK_1] = base_addr;
+  stop[BANK_1] = (end < bank2) ? end : bank2;
+  next[BANK_2] = (base_addr > bank2) ? base_addr : bank2;
+  stop[BANK_2] = end;
+
+  sl->flash_mass_erased = false;
+  wait_flash_busy(sl);
+  clear_flash_error(sl);
+  unlock_flash_if(sl);
+
+  while (ret == 0 &&
+         (next[BANK_1] < stop[BANK_1] || next[BANK_2] < stop[BANK_2] || busy[BANK_1] || busy[BANK_2])) {
+    // nothing to start, sleep until the erase that began first is done
+    if ((busy[BANK_1] || next[BANK_1] >= stop[BANK_1]) && (busy[BANK_2] || next[BANK_2] >= stop[BANK_2])) {
+      bank = (busy[BANK_1] && (!busy[BANK_2] || (int32_t) (started[BANK_2] - started[BANK_1]) >= 0)) ?
+             BANK_1 : BANK_2;
+      stlink_poll_wait_since(sl, op, cur_size[bank], started[bank], is_flash_bank_idle, &bank, 0);
+    }
+
+    for (bank = BANK_1; bank <= BANK_2 && ret == 0; bank++) {
+      if (busy[bank]) {
+        if (is_flash_bank_busy(sl, bank)) { continue; }
+
+        busy[bank] = false;
+        fprintf(stdout, "-> Flash page at %#x erased (size: %#x)\n", cur[bank], cur_size[bank]);
+        fflush(stdout);
+      }
+
+      while (next[bank] < stop[bank]) {
+        cur[bank] = next[bank];
+        cur_size[bank] = stlink_calculate_pagesize(sl, cur[bank]);
+        next[bank] += cur_size[bank];
+
+        if (sl->flash_blank_check && stlink_is_page_erased(sl, cur[bank], cur_size[bank])) {
+          fprintf(stdout, "-> Flash page at %#x already blank (size: %#x)\n", cur[bank], cur_size[bank]);
+          continue;
+        }
+
+        if (start_flash_bank_erase(sl, cur[bank], bank)) {
+          WLOG("erase setup failed for page %#x\n", cur[bank]);
+          ret = -1;
+        }
+
+        busy[bank] = true;
+        started[bank] = time_us();
+        break;
+      }
+    }
+  }
+
+  wait_flash_busy(sl);
+
+  if (sl->flash_type == STM32_FLASH_TYPE_F1_XL) {
+    clear_flash_cr_per(sl, BANK_1);
+    clear_flash_cr_per(sl, BANK_2);
+  }
+
+  lock_flash(sl);
+
+  if (check_flash_error(sl)) { ret = -1; }
+
+  fprintf(stdout, "\n");
+  return (ret);
+}
+
 int32_t stlink_erase_flash_section(stlink_t *sl, stm32_addr_t base_addr, uint32_t size, bool align_size) {
   // Check the address and size validity
   if (stlink_check_address_range_validity(sl, base_addr, size) < 0) {
@@ -1219,6 +1421,24 @@ int32_t stlink_erase_flash_section(stlink_t *sl, stm32_addr_t base_addr, uint32_
   }
 
   stm32_addr_t addr = base_addr;
+
+  // erase both banks at once if the section spans them
+  if (flash_bank2_base(sl) && base_addr < flash_bank2_base(sl) &&
+      base_addr + size > flash_bank2_base(sl)) {
+    do {
+      uint32_t page_size = stlink_calculate_pagesize(sl, addr);
+
+      if ((addr + page_size) > (base_addr + size) && !align_size) {
+        ELOG("Invalid size (not aligned with a page). Page size at address %#x is %#x\n", addr, page_size);
+        return (-1);
+      }
+
+      addr += page_size;
+    } while (addr < (base_addr + size));
+
+    return (stlink_erase_flash_section_dual(sl, base_addr, size));
+  }
+
   do {
     uint32_t page_size = stlink_calculate_pagesize(sl, addr);
 
@@ -1228,6 +1448,13 @@ int32_t stlink_erase_flash_section(stlink_t *sl, stm32_addr_t base_addr, uint32_
       return (-1);
     }
 
+    if (sl->flash_blank_check && stlink_is_page_erased(sl, addr, page_size)) {
+      fprintf(stdout, "-> Flash page at %#x already blank (size: %#x)\n", addr, page_size);
+      fflush(stdout);
+      addr += page_size;
+      continue;
+    }
+
     if (stlink_erase_flash_page(sl, addr)) {
       WLOG("Failed to erase_flash_page(%#x) == -1\n", addr);
       return (-1);
@@ -1288,6 +1515,9 @@ int32_t stlink_erase_flash_mass(stlink_t *sl) {
     err = check_flash_error(sl);
   }
 
+  // L4/G4 fast programming is only allowed on mass erased flash
+  sl->flash_mass_erased = (err == 0);
+
   return (err);
 }
 
@@ -1332,6 +1562,139 @@ int32_t stlink_mwrite_flash(stlink_t *sl, uint8_t *data, uint32_t length,
   return (err);
 }
 
+// start of the flash page holding addr, pages can differ in size
+static stm32_addr_t flash_page_start(stlink_t *sl, stm32_addr_t addr) {
+  stm32_addr_t page = sl->flash_base;
+
+  while (page + stlink_calculate_pagesize(sl, page) <= addr) {
+    page += stlink_calculate_pagesize(sl, page);
+  }
+
+  return (page);
+}
+
+static int flash_span_cmp(const void *a, const void *b) {
+  const stm32_addr_t *x = a, *y = b;
+  return (x[0] < y[0]) ? -1 : (x[0] > y[0]);
+}
+
+/**
+ * Write a scatter list into flash, touching only the pages the segments cover.
+ * Segments on the same or adjacent pages form one group that is erased at once,
+ * all groups are then programmed with a single start of the flash loader.
+ * @param sl stlink context
+ * @param segs segments, later ones win where they overlap
+ * @param count number of segments
+ * @param erase_type erase mode for each group of pages
+ * @return 0 for success, -ve for failure
+ */
+int32_t stlink_write_flash_segments(stlink_t *sl, const stlink_segment_t *segs, uint32_t count,
+                                    const enum erase_type_t erase_type) {
+  uint8_t erased_pattern = stlink_get_erased_pattern(sl);
+  stm32_addr_t (*spans)[2];
+  uint8_t **bufs;
+  stm32_addr_t entry = UINT32_MAX;
+  uint32_t i, n, start;
+  int32_t err = 0;
+
+  if (count == 0) { return (-1); }
+
+  spans = malloc(count * sizeof(*spans));
+
+  if (spans == NULL) { return (-1); }
+
+  // the pages each segment covers, checked against the flash first
+  for (i = 0; i < count; i++) {
+    if (stlink_check_address_range_validity(sl, segs[i].addr, segs[i].len) < 0) {
+      free(spans);
+      return (-1);
+    }
+
+    stm32_addr_t last = flash_page_start(sl, segs[i].addr + segs[i].len - 1);
+    spans[i][0] = flash_page_start(sl, segs[i].addr);
+    spans[i][1] = last + stlink_calculate_pagesize(sl, last);
+
+    if (segs[i].addr < entry) { entry = segs[i].addr; }
+  }
+
+  // merge the spans that overlap or touch into groups of pages
+  qsort(spans, count, sizeof(*spans), flash_span_cmp);
+
+  for (n = 0, i = 1; i < count; i++) {
+    if (spans[i][0] <= spans[n][1]) {
+      if (spans[i][1] > spans[n][1]) { spans[n][1] = spans[i][1]; }
+    } else {
+      n++;
+      spans[n][0] = spans[i][0];
+      spans[n][1] = spans[i][1];
+    }
+  }
+
+  n++;
+  ILOG("Writing %u segments as %u groups of pages\n", count, n);
+
+  bufs = calloc(n, sizeof(*bufs));
+
+  for (start = 0; bufs != NULL && start < n; start++) {
+    stm32_addr_t addr = spans[start][0];
+    uint32_t len = spans[start][1] - addr;
+
+    if ((bufs[start] = malloc(len)) == NULL) { break; }
+
+    memset(bufs[start], erased_pattern, len);
+
+    for (i = 0; i < count; i++) {
+      stm32_addr_t b = (segs[i].addr > addr) ? segs[i].addr : addr;
+      stm32_addr_t e = (segs[i].addr + segs[i].len < addr + len) ? segs[i].addr + segs[i].len : addr + len;
+
+      if (b < e) { memcpy(bufs[start] + (b - addr), segs[i].data + (b - segs[i].addr), e - b); }
+    }
+  }
+
+  if (bufs == NULL || start < n) {
+    ELOG("Cannot allocate memory for %u groups of pages\n", n);
+    err = -1;
+  } else if (erase_type == DELTA_ERASE) {
+    // delta writes compare each group against the flash on its own
+    for (start = 0; start < n && err == 0; start++) {
+      err = stlink_write_flash(sl, spans[start][0], bufs[start], spans[start][1] - spans[start][0], 0, erase_type);
+    }
+  } else {
+    flash_loader_t fl;
+
+    stlink_core_id(sl);
+
+    // erase all groups first, then program them with a single start of the flash loader
+    for (start = 0; start < n && err == 0 && erase_type == SECTION_ERASE; start++) {
+      if (stlink_erase_flash_section(sl, spans[start][0], spans[start][1] - spans[start][0], true) < 0) {
+        ELOG("Failed to erase the flash prior to writing\n");
+        err = -1;
+      }
+    }
+
+    if (err == 0) { err = stlink_flashloader_start(sl, &fl); }
+
+    for (start = 0; start < n && err == 0; start++) {
+      err = stlink_flashloader_write(sl, &fl, spans[start][0], bufs[start], spans[start][1] - spans[start][0]);
+    }
+
+    if (err == 0) { err = stlink_flashloader_stop(sl, &fl); }
+
+    for (start = 0; start < n && err == 0; start++) {
+      err = stlink_verify_write_flash(sl, spans[start][0], bufs[start], spans[start][1] - spans[start][0]);
+    }
+  }
+
+  for (start = 0; bufs != NULL && start < n; start++) { free(bufs[start]); }
+
+  free(bufs);
+  free(spans);
+
+  if (err == 0) { stlink_fwrite_finalize(sl, entry); }
+
+  return (err);
+}
+
 /**
  * Write the given binary file into flash at address "addr"
  * @param sl
@@ -1420,9 +1783,15 @@ int32_t stlink_fcheck_flash(stlink_t *sl, const char *path, stm32_addr_t addr) {
  */
 int32_t stlink_verify_write_flash(stlink_t *sl, stm32_addr_t address, uint8_t *data, uint32_t length) {
   uint32_t off;
-  uint32_t cmp_size = (sl->flash_pgsz > 0x1800) ? 0x1800 : sl->flash_pgsz;
+  uint32_t cmp_size = sl->xfer_caps.block_size;
   ILOG("Starting verification of write complete\n");
 
+  // checksum the range on the target, read it back only if that fails
+  if (stlink_flash_loader_verify_crc32(sl, address, data, length) == 0) {
+    ILOG("Flash written and verified by crc32! jolly good!\n");
+    return (0);
+  }
+
   for (off = 0; off < length; off += cmp_size) {
     uint32_t aligned_size;
 
@@ -1496,6 +1865,102 @@ int32_t stlink_check_address_alignment(stlink_t *sl, stm32_addr_t addr) {
   return 0;
 }
 
+// erase, program and verify one run of adjacent pages
+static int32_t stlink_write_flash_run(stlink_t *sl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
+  flash_loader_t fl;
+
+  if (stlink_erase_flash_section(sl, addr, len, true) < 0) {
+    ELOG("Failed to erase the flash prior to writing\n");
+    return (-1);
+  }
+
+  if (stlink_flashloader_start(sl, &fl) ||
+      stlink_flashloader_write(sl, &fl, addr, base, len) ||
+      stlink_flashloader_stop(sl, &fl)) {
+    return (-1);
+  }
+
+  return (stlink_verify_write_flash(sl, addr, base, len));
+}
+
+/**
+ * Write only the flash pages whose contents differ from the image. Pages are
+ * compared by their crc32 on the target, or by reading them back if the
+ * crc32 routine cannot run.
+ * @param sl stlink context
+ * @param addr page aligned start address
+ * @param base image
+ * @param len image size
+ * @return 0 for success, -ve for failure
+ */
+static int32_t stlink_write_flash_delta(stlink_t *sl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
+  uint32_t off = 0, run_off = 0, run_len = 0;
+  uint32_t pages = 0, changed = 0;
+  int32_t crc = 0; // crc32 routine: 1 in SRAM, 0 to be loaded, -1 not usable
+  int32_t ret = 0, diff;
+
+  // an unchanged image, the common case, costs a single crc32 run
+  if (stlink_flash_loader_load_crc32(sl) == 0) {
+    crc = 1;
+
+    if (stlink_flash_loader_check_crc32(sl, addr, base, len) == 0) {
+      ILOG("Delta write: image unchanged\n");
+      return (0);
+    }
+  }
+
+  while (off < len && ret == 0) {
+    uint32_t page_size = stlink_calculate_pagesize(sl, addr + off);
+    uint32_t size = (len - off > page_size) ? page_size : len - off;
+
+    if (crc == 0) { crc = (stlink_flash_loader_load_crc32(sl) == 0) ? 1 : -1; }
+
+    diff = (crc > 0) ? stlink_flash_loader_check_crc32(sl, addr + off, base + off, size) : -1;
+
+    if (diff < 0) {
+      // compare the page with the target contents read back straight into page
+      uint8_t *page = malloc(size);
+
+      crc = -1;
+
+      if (page == NULL || stlink_read_mem(sl, addr + off, size, page)) {
+        ret = -1;
+      } else {
+        diff = (memcmp(page, base + off, size) != 0);
+      }
+
+      free(page);
+    }
+
+    if (ret) {
+      break;
+    } else if (diff) {
+      if (run_len == 0) { run_off = off; }
+      run_len += size;
+      changed++;
+    } else if (run_len) {
+      ret = stlink_write_flash_run(sl, addr + run_off, base + run_off, run_len);
+      run_len = 0;
+
+      // the flash loader has overwritten the routine in SRAM
+      if (crc > 0) { crc = 0; }
+    }
+
+    off += size;
+    pages++;
+  }
+
+  if (ret == 0 && run_len) {
+    ret = stlink_write_flash_run(sl, addr + run_off, base + run_off, run_len);
+  }
+
+  if (ret == 0) {
+    ILOG("Delta write: %u of %u pages changed\n", changed, pages);
+  }
+
+  return (ret);
+}
+
 int32_t stlink_write_flash(stlink_t *sl, stm32_addr_t addr, uint8_t *base,
                            uint32_t len, uint8_t eraseonly,
                            const enum erase_type_t erase_type) {
@@ -1523,6 +1988,10 @@ int32_t stlink_write_flash(stlink_t *sl, stm32_addr_t addr, uint8_t *base,
   // make sure we've loaded the context with the chip details
   stlink_core_id(sl);
 
+  if (erase_type == DELTA_ERASE) {
+    return (stlink_write_flash_delta(sl, addr, base, len));
+  }
+
   // Erase this section of the flash
   if ((erase_type == SECTION_ERASE) &&
       stlink_erase_flash_section(sl, addr, len, true) < 0) {
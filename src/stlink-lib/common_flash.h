@@ -14,6 +14,7 @@ enum erase_type_t {
     NO_ERASE = 0,
     SECTION_ERASE = 1,
     MASS_ERASE = 2,
+    DELTA_ERASE = 3,    // erase and program only the pages that differ
 };
 
 uint32_t get_stm32l0_flash_base(stlink_t *);
@@ -24,6 +25,7 @@ void clear_flash_error(stlink_t *);
 uint32_t read_flash_sr(stlink_t *sl, uint32_t bank);
 uint32_t is_flash_busy(stlink_t *sl);
 void wait_flash_busy(stlink_t *);
+void wait_flash_busy_op(stlink_t *, enum stlink_poll_op, uint32_t);
 int32_t check_flash_error(stlink_t *);
 // static inline uint32_t is_flash_locked(stlink_t *sl);
 // static void unlock_flash(stlink_t *sl);
@@ -42,9 +44,12 @@ void clear_flash_cr_pg(stlink_t *, uint32_t);
 // static inline void write_flash_cr_bker_pnb(stlink_t *sl, uint32_t n);
 // static void set_flash_cr_strt(stlink_t *sl, uint32_t bank);
 // static void set_flash_cr_mer(stlink_t *sl, bool v, uint32_t bank);
+bool stlink_is_page_erased(stlink_t *sl, stm32_addr_t addr, uint32_t size);
 int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr);
 int32_t stlink_erase_flash_section(stlink_t *sl, stm32_addr_t base_addr, uint32_t size, bool align_size);
 int32_t stlink_erase_flash_mass(stlink_t *sl);
+int32_t stlink_write_flash_segments(stlink_t *sl, const stlink_segment_t *segs, uint32_t count,
+                                    const enum erase_type_t erase_type);
 int32_t stlink_mwrite_flash(stlink_t *sl, uint8_t *data, uint32_t length,
                             stm32_addr_t addr, const enum erase_type_t erase);
 int32_t stlink_fwrite_flash(stlink_t *sl, const char *path, stm32_addr_t addr,
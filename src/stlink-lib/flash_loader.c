@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -14,8 +15,10 @@
 #include "flash_loader.h"
 
 #include "common_flash.h"
+#include "flash_poll.h"
 #include "helper.h"
 #include "logging.h"
+#include "lz4.h"
 #include "read_write.h"
 #include "register.h"
 
@@ -161,6 +164,167 @@ static const uint8_t loader_code_stm32f7_lv[] = {
     0x0e, 0x00, 0x00, 0x00
 };
 
+// flashloaders/stm32l4fast.s -- fast programming by 256 byte rows, for L4 and G4
+static const uint8_t loader_code_stm32l4_fast[] = {
+    0xdf, 0xf8, 0x34, 0xc0,
+    0xdf, 0xf8, 0x34, 0xa0,
+    0xe2, 0x44, 0x40, 0xf2,
+    0x00, 0x1b, 0x05, 0x68,
+    0x44, 0x68, 0x0d, 0x60,
+    0x4c, 0x60, 0x00, 0xf1,
+    0x08, 0x00, 0x01, 0xf1,
+    0x08, 0x01, 0xbb, 0xf1,
+    0x08, 0x0b, 0xf4, 0xdc,
+    0xda, 0xf8, 0x00, 0x40,
+    0x14, 0xf4, 0x80, 0x3f,
+    0xfa, 0xd1, 0xb2, 0xf5,
+    0x80, 0x72, 0xea, 0xdc,
+    0x00, 0xbe, 0x00, 0xbf,
+    0x00, 0x20, 0x02, 0x40,
+    0x10, 0x00, 0x00, 0x00
+};
+
+// flashloaders/stm32g0.s -- compiled for armv6-m, for STM32G0 and STM32C0
+static const uint8_t loader_code_stm32g0[] = {
+    0x07, 0x4f, 0x08, 0x4d,
+    0x3d, 0x44, 0x08, 0x4f,
+    0x04, 0x68, 0x46, 0x68,
+    0x0c, 0x60, 0x4e, 0x60,
+    0x08, 0x30, 0x08, 0x31,
+    0x2c, 0x68, 0x3c, 0x42,
+    0xfc, 0xd1, 0x08, 0x3a,
+    0xf4, 0xdc, 0x00, 0xbe,
+    0x00, 0x20, 0x02, 0x40,
+    0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x03, 0x00
+};
+
+// flashloaders/stm32wb.s
+static const uint8_t loader_code_stm32wb[] = {
+    0xdf, 0xf8, 0x28, 0xc0,
+    0xdf, 0xf8, 0x28, 0xa0,
+    0xe2, 0x44, 0x05, 0x68,
+    0x44, 0x68, 0x0d, 0x60,
+    0x4c, 0x60, 0x00, 0xf1,
+    0x08, 0x00, 0x01, 0xf1,
+    0x08, 0x01, 0xda, 0xf8,
+    0x00, 0x40, 0x14, 0xf4,
+    0x80, 0x3f, 0xfa, 0xd1,
+    0x08, 0x3a, 0xf0, 0xdc,
+    0x00, 0xbe, 0x00, 0xbf,
+    0x00, 0x40, 0x00, 0x58,
+    0x10, 0x00, 0x00, 0x00
+};
+
+// flashloaders/stm32l5.s
+static const uint8_t loader_code_stm32l5[] = {
+    0xdf, 0xf8, 0x28, 0xc0,
+    0xdf, 0xf8, 0x28, 0xa0,
+    0xe2, 0x44, 0x05, 0x68,
+    0x44, 0x68, 0x0d, 0x60,
+    0x4c, 0x60, 0x00, 0xf1,
+    0x08, 0x00, 0x01, 0xf1,
+    0x08, 0x01, 0xda, 0xf8,
+    0x00, 0x40, 0x14, 0xf4,
+    0x80, 0x3f, 0xfa, 0xd1,
+    0x08, 0x3a, 0xf0, 0xdc,
+    0x00, 0xbe, 0x00, 0xbf,
+    0x00, 0x20, 0x02, 0x40,
+    0x20, 0x00, 0x00, 0x00
+};
+
+// flashloaders/stm32mailbox.s -- double-buffered, for F2/F4/F7/L4
+static const uint8_t loader_code_stm32mailbox[] = {
+    0x4f, 0xf0, 0x00, 0x07,
+    0x55, 0xf8, 0x07, 0x80,
+    0xb8, 0xf1, 0x00, 0x0f,
+    0xfa, 0xd0, 0x18, 0xf1,
+    0x01, 0x0f, 0x29, 0xd0,
+    0x81, 0x46, 0x07, 0xb1,
+    0x91, 0x44, 0x01, 0x2e,
+    0x0f, 0xd0, 0x04, 0x2e,
+    0x08, 0xd0, 0x59, 0xf8,
+    0x04, 0xab, 0x59, 0xf8,
+    0x04, 0xbb, 0x41, 0xf8,
+    0x04, 0xab, 0x41, 0xf8,
+    0x04, 0xbb, 0x08, 0xe0,
+    0x59, 0xf8, 0x04, 0xab,
+    0x41, 0xf8, 0x04, 0xab,
+    0x03, 0xe0, 0x19, 0xf8,
+    0x01, 0xab, 0x01, 0xf8,
+    0x01, 0xab, 0xbf, 0xf3,
+    0x4f, 0x8f, 0xd3, 0xf8,
+    0x00, 0xa0, 0x1a, 0xea,
+    0x04, 0x0f, 0xf8, 0xd1,
+    0xb8, 0xeb, 0x06, 0x08,
+    0xdf, 0xdc, 0x4f, 0xf0,
+    0x00, 0x0a, 0x45, 0xf8,
+    0x07, 0xa0, 0x87, 0xf0,
+    0x04, 0x07, 0xcd, 0xe7,
+    0x4f, 0xf0, 0x00, 0x02,
+    0x00, 0xbe, 0x00, 0xbf
+};
+
+// flashloaders/stm32lz4.s -- expands LZ4 blocks, for F2/F4/F7/L4
+static const uint8_t loader_code_stm32lz4[] = {
+    0x01, 0x44, 0x17, 0x46,
+    0x10, 0xf8, 0x01, 0x8b,
+    0x4f, 0xea, 0x18, 0x19,
+    0x00, 0xf0, 0x22, 0xf8,
+    0xb9, 0xf1, 0x00, 0x0f,
+    0x06, 0xd0, 0x10, 0xf8,
+    0x01, 0xab, 0x07, 0xf8,
+    0x01, 0xab, 0xb9, 0xf1,
+    0x01, 0x09, 0xf5, 0xe7,
+    0x88, 0x42, 0x1f, 0xd2,
+    0x10, 0xf8, 0x01, 0xab,
+    0x10, 0xf8, 0x01, 0xbb,
+    0x4a, 0xea, 0x0b, 0x2a,
+    0xa7, 0xeb, 0x0a, 0x0a,
+    0x08, 0xf0, 0x0f, 0x09,
+    0x00, 0xf0, 0x0a, 0xf8,
+    0x09, 0xf1, 0x04, 0x09,
+    0x1a, 0xf8, 0x01, 0xbb,
+    0x07, 0xf8, 0x01, 0xbb,
+    0xb9, 0xf1, 0x01, 0x09,
+    0xf8, 0xd1, 0xd7, 0xe7,
+    0xb9, 0xf1, 0x0f, 0x0f,
+    0x05, 0xd1, 0x10, 0xf8,
+    0x01, 0xbb, 0xd9, 0x44,
+    0xbb, 0xf1, 0xff, 0x0f,
+    0xf9, 0xd0, 0x70, 0x47,
+    0xa7, 0xeb, 0x02, 0x00,
+    0x01, 0x46, 0x00, 0x29,
+    0x1e, 0xd0, 0x01, 0x2e,
+    0x0f, 0xd0, 0x04, 0x2e,
+    0x08, 0xd0, 0x52, 0xf8,
+    0x04, 0xab, 0x52, 0xf8,
+    0x04, 0xbb, 0x43, 0xf8,
+    0x04, 0xab, 0x43, 0xf8,
+    0x04, 0xbb, 0x08, 0xe0,
+    0x52, 0xf8, 0x04, 0xab,
+    0x43, 0xf8, 0x04, 0xab,
+    0x03, 0xe0, 0x12, 0xf8,
+    0x01, 0xab, 0x03, 0xf8,
+    0x01, 0xab, 0xbf, 0xf3,
+    0x4f, 0x8f, 0xd4, 0xf8,
+    0x00, 0xa0, 0x1a, 0xea,
+    0x05, 0x0f, 0xf8, 0xd1,
+    0x89, 0x1b, 0xe0, 0xdc,
+    0x00, 0xbe, 0x00, 0xbf
+};
+
+
+static const uint8_t loader_code_crc32[] = {
+    // flashloaders/crc32.s
+    0xdb, 0x43, 0x04, 0x78,
+    0x40, 0x1c, 0x5c, 0x40,
+    0xe4, 0xb2, 0xa4, 0x00,
+    0x0c, 0x59, 0x1b, 0x0a,
+    0x63, 0x40, 0x52, 0x1e,
+    0xf5, 0xdc, 0xdb, 0x43,
+    0x00, 0xbe, 0xc0, 0x46
+};
 
 int32_t stlink_flash_loader_init(stlink_t *sl, flash_loader_t *fl) {
     uint32_t size = 0;
@@ -313,6 +477,20 @@ int32_t stlink_flash_loader_write_to_sram(stlink_t *sl, stm32_addr_t* addr, uint
                (sl->chip_id == STM32_CHIPID_L496x_L4A6x)) {
         loader_code = loader_code_stm32l4;
         loader_size = sizeof(loader_code_stm32l4);
+    } else if (sl->flash_type == STM32_FLASH_TYPE_G0 ||
+               sl->flash_type == STM32_FLASH_TYPE_C0) {
+        loader_code = loader_code_stm32g0;
+        loader_size = sizeof(loader_code_stm32g0);
+    } else if (sl->flash_type == STM32_FLASH_TYPE_G4) {
+        // same flash register layout and double word programming as L4
+        loader_code = loader_code_stm32l4;
+        loader_size = sizeof(loader_code_stm32l4);
+    } else if (sl->flash_type == STM32_FLASH_TYPE_WB_WL) {
+        loader_code = loader_code_stm32wb;
+        loader_size = sizeof(loader_code_stm32wb);
+    } else if (sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5) {
+        loader_code = loader_code_stm32l5;
+        loader_size = sizeof(loader_code_stm32l5);
     } else {
         ELOG("unknown coreid, not sure what flash loader to use, aborting! coreid: %x, chipid: %x\n",
             sl->core_id, sl->chip_id);
@@ -330,11 +508,26 @@ int32_t stlink_flash_loader_write_to_sram(stlink_t *sl, stm32_addr_t* addr, uint
     return (0); // success
 }
 
+static void flash_loader_print_state(stlink_t *sl) {
+    struct stlink_reg rr;
+    uint32_t dhcsr, dfsr, cfsr, hfsr;
+
+    dhcsr = dfsr = cfsr = hfsr = 0;
+    stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
+    stlink_read_debug32(sl, STLINK_REG_DFSR, &dfsr);
+    stlink_read_debug32(sl, STLINK_REG_CFSR, &cfsr);
+    stlink_read_debug32(sl, STLINK_REG_HFSR, &hfsr);
+    stlink_read_all_regs(sl, &rr);
+
+    WLOG("Loader state: R2 0x%X R15 0x%X\n", rr.r[2], rr.r[15]);
+    if (dhcsr != 0x3000B || dfsr || cfsr || hfsr) {
+        WLOG("MCU state: DHCSR 0x%X DFSR 0x%X CFSR 0x%X HFSR 0x%X\n", dhcsr, dfsr, cfsr, hfsr);
+    }
+}
+
 int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t target, const uint8_t* buf, uint32_t size) {
     struct stlink_reg rr;
-    uint32_t timeout;
     uint32_t flash_base = 0;
-    uint32_t dhcsr, dfsr, cfsr, hfsr;
 
     DLOG("Running flash loader, write address:%#x, size: %u\n", target, size);
 
@@ -363,29 +556,8 @@ int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t t
   /* Run loader */
   stlink_run(sl, RUN_FLASH_LOADER);
 
-/*
- * This piece of code used to try to spin for .1 second by waiting doing 10000 rounds of 10 µs.
- * But because this usually runs on Unix-like OSes, the 10 µs get rounded up to the "tick"
- * (actually almost two ticks) of the system. 1 ms. Thus, the ten thousand attempts, when
- * "something goes wrong" that requires the error message "flash loader run error" would wait
- * for something like 20 seconds before coming up with the error.
- * By increasing the sleep-per-round to the same order-of-magnitude as the tick-rounding that
- * the OS uses, the wait until the error message is reduced to the same order of magnitude
- * as what was intended. -- REW.
- */
-
-  // wait until done (reaches breakpoint)
-  timeout = time_ms() + 500;
-  while (time_ms() < timeout) {
-      usleep(10000);
-
-      if (stlink_is_core_halted(sl)) {
-          timeout = 0;
-          break;
-      }
-  }
-
-  if (timeout) {
+  // wait until done (reaches breakpoint), sleeping for the learned run time of the chunk
+  if (stlink_poll_wait(sl, STLINK_POLL_LOADER, size, stlink_is_core_halted, 500)) {
       ELOG("Flash loader run error\n");
       goto error;
   }
@@ -408,21 +580,441 @@ int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t t
   return (0);
 
   error:
-      dhcsr = dfsr = cfsr = hfsr = 0;
-      stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
-      stlink_read_debug32(sl, STLINK_REG_DFSR, &dfsr);
-      stlink_read_debug32(sl, STLINK_REG_CFSR, &cfsr);
-      stlink_read_debug32(sl, STLINK_REG_HFSR, &hfsr);
-      stlink_read_all_regs(sl, &rr);
-
-      WLOG("Loader state: R2 0x%X R15 0x%X\n", rr.r[2], rr.r[15]);
-      if (dhcsr != 0x3000B || dfsr || cfsr || hfsr) {
-          WLOG("MCU state: DHCSR 0x%X DFSR 0x%X CFSR 0x%X HFSR 0x%X\n", dhcsr, dfsr, cfsr, hfsr);
-      }
+      flash_loader_print_state(sl);
 
   return (-1);
 }
 
+/*
+ * Double-buffered writes for F2/F4/F7/L4 (flashloaders/stm32mailbox.s)
+ *
+ * SRAM layout after the regular loader: mailbox loader, two mailbox words,
+ * buffer 0 and buffer 1. The host uploads chunk N+1 into one buffer while
+ * the loader programs chunk N from the other one; a mailbox word holds the
+ * byte count of its buffer and is cleared by the loader when it is done.
+ */
+#define MAILBOX_TIMEOUT_MS  2000
+#define MAILBOX_END         0xffffffff
+#define MAILBOX_BUF_MIN     0x1000
+#define MAILBOX_BUF_MAX     0x8000
+#define STM32F7_DTCM_SIZE   0x10000
+
+static uint32_t flash_loader_mailbox_buf_size(stlink_t *sl, flash_loader_t *fl) {
+    stm32_addr_t bufs = fl->buf_addr + sizeof(loader_code_stm32mailbox) + 8;
+    stm32_addr_t sram_end = sl->sram_base + sl->sram_size;
+    uint32_t buf_size;
+
+    if (sl->flash_type == STM32_FLASH_TYPE_F7) {
+        // stay in DTCM, the loader must not read the buffers through the D-cache
+        sram_end = sl->sram_base + STM32F7_DTCM_SIZE;
+    }
+
+    for (buf_size = MAILBOX_BUF_MAX; buf_size >= MAILBOX_BUF_MIN; buf_size /= 2) {
+        if (bufs + 2 * buf_size <= sram_end) { return (buf_size); }
+    }
+
+    return (0);
+}
+
+struct flash_loader_mailbox {
+    stm32_addr_t addr;
+    int32_t error;
+};
+
+static bool flash_loader_mailbox_empty(stlink_t *sl, void *arg) {
+    struct flash_loader_mailbox *mb = arg;
+    uint32_t val;
+
+    if (stlink_read_debug32(sl, mb->addr, &val)) {
+        mb->error = -1;
+        return (true);
+    }
+
+    return (val == 0);
+}
+
+static bool flash_loader_halted(stlink_t *sl, void *arg) {
+    (void) arg;
+    return (stlink_is_core_halted(sl));
+}
+
+// the loader takes a buffer once it is done with the other one, not before it was posted
+static uint32_t flash_loader_mailbox_start(uint32_t posted, uint32_t ready) {
+    return (((int32_t) (ready - posted) > 0) ? ready : posted);
+}
+
+/*
+ * Waits until the loader has programmed the size bytes posted to a mailbox,
+ * start is the time_us() when it could begin with them
+ */
+static int32_t flash_loader_mailbox_wait(stlink_t *sl, stm32_addr_t mbox, uint32_t size, uint32_t start) {
+    struct flash_loader_mailbox mb = { mbox, 0 };
+
+    if (stlink_poll_wait_since(sl, STLINK_POLL_LOADER, size, start,
+                               flash_loader_mailbox_empty, &mb, MAILBOX_TIMEOUT_MS)) {
+        ELOG("Flash loader mailbox timeout\n");
+        return (-1);
+    }
+
+    return (mb.error);
+}
+
+// status register, busy mask and program unit of the F2/F4/F7/L4 loaders
+static void flash_loader_program_unit(stlink_t *sl, uint32_t *flash_sr, uint32_t *busy, uint32_t *unit) {
+    if (sl->flash_type == STM32_FLASH_TYPE_L4) {
+        *flash_sr = FLASH_L4_SR;
+        *busy = (1 << FLASH_L4_SR_BSY);
+        *unit = 8;
+    } else {
+        *flash_sr = (sl->flash_type == STM32_FLASH_TYPE_F7) ? FLASH_F7_SR : FLASH_F4_SR;
+        *busy = (1 << FLASH_F4_SR_BSY);
+        // follow the parallelism set by stlink_flashloader_start()
+        *unit = (((read_flash_cr(sl, BANK_1) >> 8) & 0x3) == 2) ? 4 : 1;
+    }
+}
+
+static int32_t stlink_flash_loader_run_mailbox(stlink_t *sl, flash_loader_t *fl, stm32_addr_t target,
+                                               const uint8_t *buf, uint32_t len, uint32_t buf_size) {
+    static const uint8_t pad[8] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    stm32_addr_t loader = fl->buf_addr;
+    stm32_addr_t mbox = loader + sizeof(loader_code_stm32mailbox);
+    stm32_addr_t bufs = mbox + 8;
+    uint32_t flash_sr, busy, unit, ready;
+    uint32_t posted[2], posted_size[2];
+    uint32_t off, n;
+
+    flash_loader_program_unit(sl, &flash_sr, &busy, &unit);
+
+    DLOG("Running mailbox flash loader, write address:%#x, size: %u, buffers: 2x%u\n", target, len, buf_size);
+
+    if (stlink_write_mem(sl, loader, sizeof(loader_code_stm32mailbox), loader_code_stm32mailbox) ||
+        stlink_write_debug32(sl, mbox, 0) || stlink_write_debug32(sl, mbox + 4, 0)) {
+        ELOG("Failed to write mailbox flash loader to sram!\n");
+        return (-1);
+    }
+
+    /* Setup core */
+    stlink_write_reg(sl, bufs, 0);      // buffer 0, buffer 1 follows
+    stlink_write_reg(sl, target, 1);    // target
+    stlink_write_reg(sl, buf_size, 2);  // size of one buffer
+    stlink_write_reg(sl, flash_sr, 3);  // FLASH_SR
+    stlink_write_reg(sl, busy, 4);      // busy mask
+    stlink_write_reg(sl, mbox, 5);      // mailbox
+    stlink_write_reg(sl, unit, 6);      // program unit
+    stlink_write_reg(sl, loader, 15);   // pc register
+
+    if (fl->iwdg_kr) {
+        stlink_write_debug32(sl, fl->iwdg_kr, STM32F0_WDG_KR_KEY_RELOAD);
+    }
+
+    stlink_run(sl, RUN_FLASH_LOADER);
+    ready = time_us();
+
+    for (off = 0, n = 0; off < len; n++) {
+        uint32_t size = (len - off > buf_size) ? buf_size : len - off;
+        stm32_addr_t slot = bufs + (n & 1) * buf_size;
+
+        // wait until the loader has programmed this buffer
+        if (n >= 2) {
+            if (flash_loader_mailbox_wait(sl, mbox + (n & 1) * 4, posted_size[n & 1],
+                                          flash_loader_mailbox_start(posted[n & 1], ready))) {
+                goto error;
+            }
+
+            ready = time_us();
+        }
+
+        if (stlink_write_mem(sl, slot, size, buf + off)) { goto error; }
+
+        // the loader programs whole units, fill the last one with erased value
+        if (size % unit && stlink_write_mem(sl, slot + size, unit - size % unit, pad)) { goto error; }
+
+        if (fl->iwdg_kr) {
+            stlink_write_debug32(sl, fl->iwdg_kr, STM32F0_WDG_KR_KEY_RELOAD);
+        }
+
+        if (stlink_write_debug32(sl, mbox + (n & 1) * 4, size)) { goto error; }
+
+        posted[n & 1] = time_us();
+        posted_size[n & 1] = size;
+        off += size;
+    }
+
+    // the loader handles the buffers in order, so it halts only after the last one
+    if (n >= 2) {
+        if (flash_loader_mailbox_wait(sl, mbox + (n & 1) * 4, posted_size[n & 1],
+                                      flash_loader_mailbox_start(posted[n & 1], ready))) {
+            goto error;
+        }
+
+        ready = time_us();
+    }
+
+    if (stlink_write_debug32(sl, mbox + (n & 1) * 4, MAILBOX_END)) { goto error; }
+
+    if (n > 0 && stlink_poll_wait_since(sl, STLINK_POLL_LOADER, posted_size[(n - 1) & 1],
+                                        flash_loader_mailbox_start(posted[(n - 1) & 1], ready),
+                                        flash_loader_halted, NULL, MAILBOX_TIMEOUT_MS)) {
+        ELOG("Flash loader run error\n");
+        goto error;
+    }
+
+    return (0);
+
+error:
+    stlink_force_debug(sl);
+    flash_loader_print_state(sl);
+    return (-1);
+}
+
+/*
+ * Compressed writes for F2/F4/F7/L4 (flashloaders/stm32lz4.s)
+ *
+ * SRAM layout after the regular loader: LZ4 loader, staging buffer and the
+ * compressed block. Every chunk is compressed on the host and expanded by the
+ * loader before it is programmed, so that only the compressed data crosses
+ * the debug link. Erased padding and constant tables shrink the most.
+ */
+#define LZ4_CHUNK_MIN       0x1000
+#define LZ4_CHUNK_MAX       0x4000
+
+static uint32_t flash_loader_lz4_chunk_size(stlink_t *sl, flash_loader_t *fl) {
+    stm32_addr_t stage = fl->buf_addr + sizeof(loader_code_stm32lz4);
+    stm32_addr_t sram_end = sl->sram_base + sl->sram_size;
+    uint32_t chunk;
+
+    if (sl->flash_type == STM32_FLASH_TYPE_F7) {
+        // stay in DTCM, the loader must not read the buffers through the D-cache
+        sram_end = sl->sram_base + STM32F7_DTCM_SIZE;
+    }
+
+    for (chunk = LZ4_CHUNK_MAX; chunk >= LZ4_CHUNK_MIN; chunk /= 2) {
+        if (stage + chunk + STLINK_LZ4_BOUND(chunk) <= sram_end) { return (chunk); }
+    }
+
+    return (0);
+}
+
+static int32_t stlink_flash_loader_run_lz4(stlink_t *sl, flash_loader_t *fl, stm32_addr_t target,
+                                           const uint8_t *buf, uint32_t len, uint32_t chunk) {
+    stm32_addr_t loader = fl->buf_addr;
+    stm32_addr_t stage = loader + sizeof(loader_code_stm32lz4);
+    stm32_addr_t block = stage + chunk;
+    uint8_t *raw = malloc(chunk);
+    uint8_t *packed = malloc(STLINK_LZ4_BOUND(chunk));
+    uint32_t flash_sr, busy, unit, off, sent = 0;
+    struct stlink_reg rr;
+    int32_t ret = -1;
+
+    flash_loader_program_unit(sl, &flash_sr, &busy, &unit);
+
+    DLOG("Running LZ4 flash loader, write address:%#x, size: %u, chunks: %u\n", target, len, chunk);
+
+    if (raw == NULL || packed == NULL ||
+        stlink_write_mem(sl, loader, sizeof(loader_code_stm32lz4), loader_code_stm32lz4)) {
+        ELOG("Failed to write LZ4 flash loader to sram!\n");
+        goto out;
+    }
+
+    for (off = 0; off < len;) {
+        uint32_t size = (len - off > chunk) ? chunk : len - off;
+        uint32_t padded = (size + unit - 1) / unit * unit;
+        uint32_t packed_len;
+
+        // the loader programs whole units, fill the last one with erased value
+        memcpy(raw, buf + off, size);
+        memset(raw + size, 0xff, padded - size);
+
+        packed_len = stlink_lz4_compress(raw, padded, packed, STLINK_LZ4_BOUND(chunk));
+
+        if (packed_len == 0 || stlink_write_mem(sl, block, packed_len, packed)) { goto error; }
+
+        /* Setup core */
+        stlink_write_reg(sl, block, 0);       // compressed block
+        stlink_write_reg(sl, packed_len, 1);  // size of the block
+        stlink_write_reg(sl, stage, 2);       // staging buffer
+        stlink_write_reg(sl, target + off, 3); // target
+        stlink_write_reg(sl, flash_sr, 4);    // FLASH_SR
+        stlink_write_reg(sl, busy, 5);        // busy mask
+        stlink_write_reg(sl, unit, 6);        // program unit
+        stlink_write_reg(sl, loader, 15);     // pc register
+
+        if (fl->iwdg_kr) {
+            stlink_write_debug32(sl, fl->iwdg_kr, STM32F0_WDG_KR_KEY_RELOAD);
+        }
+
+        stlink_run(sl, RUN_FLASH_LOADER);
+
+        if (stlink_poll_wait(sl, STLINK_POLL_LOADER, padded, stlink_is_core_halted, 500)) {
+            ELOG("Flash loader run error\n");
+            goto error;
+        }
+
+        // expanded size and the bytes left to program
+        stlink_read_reg(sl, 0, &rr);
+        stlink_read_reg(sl, 1, &rr);
+
+        if (rr.r[0] != padded || rr.r[1] != 0) {
+            ELOG("Flash loader write error\n");
+            goto error;
+        }
+
+        sent += packed_len;
+        off += size;
+    }
+
+    ILOG("Compressed %u bytes to %u for the transfer (%u%%)\n", len, sent,
+         (uint32_t) ((uint64_t) sent * 100 / len));
+    ret = 0;
+    goto out;
+
+error:
+    stlink_force_debug(sl);
+    flash_loader_print_state(sl);
+
+out:
+    free(raw);
+    free(packed);
+    return (ret);
+}
+
+/*
+ * On-target CRC-32 verification (flashloaders/crc32.s)
+ *
+ * The routine and its 1K lookup table are placed at the start of SRAM and
+ * run over the flash range in chunks, so only the checksum crosses the debug
+ * link. The CRC is the zlib one; the host computes it over the image and the
+ * caller falls back to a full readback if it does not match or cannot run.
+ * Returns 0 on match, 1 on mismatch and -1 if the routine could not be used.
+ */
+#define CRC32_POLY        0xEDB88320
+#define CRC32_CHUNK       0x10000
+#define CRC32_TIMEOUT_MS  2000
+
+// the table is built per call on the stack, several probes may verify at once
+static void crc32_init_table(uint32_t crc32_table[256]) {
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; i++) {
+        for (c = i, j = 0; j < 8; j++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : (c >> 1);
+        }
+
+        crc32_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(const uint32_t crc32_table[256], uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+
+    while (len--) {
+        crc = crc32_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+
+    return (~crc);
+}
+
+static bool crc32_in_flash(stlink_t *sl, stm32_addr_t addr, uint32_t len) {
+    return (len != 0 && addr >= sl->flash_base && addr + len <= sl->flash_base + sl->flash_size);
+}
+
+/**
+ * Place the crc32 routine in SRAM for stlink_flash_loader_check_crc32()
+ * @return 0 for success, -1 if the routine cannot be used on this target
+ */
+int32_t stlink_flash_loader_load_crc32(stlink_t *sl) {
+    uint32_t crc32_table[256];
+    uint8_t code[sizeof(loader_code_crc32) + sizeof(crc32_table)];
+    uint32_t i;
+
+    // the routine lives in SRAM and takes over the core, so only use it on a halted target
+    if (sl->sram_size < sizeof(code) || !stlink_is_core_halted(sl)) { return (-1); }
+
+    crc32_init_table(crc32_table);
+    memcpy(code, loader_code_crc32, sizeof(loader_code_crc32));
+
+    for (i = 0; i < 256; i++) {
+        write_uint32(code + sizeof(loader_code_crc32) + i * 4, crc32_table[i]);
+    }
+
+    stlink_write_debug32(sl, STLINK_REG_DHCSR,
+                         STLINK_REG_DHCSR_DBGKEY | STLINK_REG_DHCSR_C_DEBUGEN |
+                         STLINK_REG_DHCSR_C_HALT | STLINK_REG_DHCSR_C_MASKINTS);
+
+    if (stlink_write_mem(sl, sl->sram_base, sizeof(code), code)) {
+        WLOG("Failed to write crc32 routine to sram\n");
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Compare a flash range with data by the routine placed with
+ * stlink_flash_loader_load_crc32(); it stays usable for further ranges
+ * until something else is written to SRAM
+ */
+int32_t stlink_flash_loader_check_crc32(stlink_t *sl, stm32_addr_t addr, const uint8_t *data, uint32_t len) {
+    uint32_t crc32_table[256];
+    stm32_addr_t table = sl->sram_base + sizeof(loader_code_crc32);
+    uint32_t iwdg_kr, host_crc, off;
+    struct stlink_reg rr;
+
+    if (!crc32_in_flash(sl, addr, len)) { return (-1); }
+
+    iwdg_kr = (sl->flash_type == STM32_FLASH_TYPE_H7) ? STM32H7_WDG_KR : STM32F0_WDG_KR;
+    rr.r[3] = 0;
+
+    for (off = 0; off < len; off += CRC32_CHUNK) {
+        uint32_t size = (len - off > CRC32_CHUNK) ? CRC32_CHUNK : len - off;
+
+        /* Setup core */
+        stlink_write_reg(sl, addr + off, 0);     // source
+        stlink_write_reg(sl, table, 1);          // crc table
+        stlink_write_reg(sl, size, 2);           // count
+        stlink_write_reg(sl, rr.r[3], 3);        // crc so far
+        stlink_write_reg(sl, sl->sram_base, 15); // pc register
+
+        stlink_write_debug32(sl, iwdg_kr, STM32F0_WDG_KR_KEY_RELOAD);
+        stlink_run(sl, RUN_FLASH_LOADER);
+
+        if (stlink_poll_wait(sl, STLINK_POLL_CRC, size, stlink_is_core_halted, CRC32_TIMEOUT_MS)) {
+            WLOG("crc32 routine run error\n");
+            goto error;
+        }
+
+        stlink_read_reg(sl, 2, &rr);
+        stlink_read_reg(sl, 3, &rr);
+
+        if (rr.r[2] != 0) {
+            WLOG("crc32 routine stopped early\n");
+            goto error;
+        }
+    }
+
+    crc32_init_table(crc32_table);
+    host_crc = crc32_update(crc32_table, 0, data, len);
+    DLOG("crc32 of %#x+%u: target %#010x, host %#010x\n", addr, len, rr.r[3], host_crc);
+
+    if (rr.r[3] != host_crc) {
+        DLOG("crc32 mismatch, target %#010x, expected %#010x\n", rr.r[3], host_crc);
+        return (1);
+    }
+
+    return (0);
+
+error:
+    stlink_force_debug(sl);
+    flash_loader_print_state(sl);
+    return (-1);
+}
+
+int32_t stlink_flash_loader_verify_crc32(stlink_t *sl, stm32_addr_t addr, const uint8_t *data, uint32_t len) {
+    if (!crc32_in_flash(sl, addr, len) || stlink_flash_loader_load_crc32(sl)) { return (-1); }
+
+    return (stlink_flash_loader_check_crc32(sl, addr, data, len));
+}
+
 
 /* === Content from old source file flashloader.c === */
 
@@ -457,8 +1049,8 @@ int32_t stm32l1_write_half_pages(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
     }
     if (!use_loader) {
       ret = 0;
-      for (off = 0; off < pagesize && !ret; off += 64) {
-        uint32_t chunk = (pagesize - off > 64) ? 64 : pagesize - off;
+      for (off = 0; off < pagesize && !ret; off += sl->xfer_caps.rw32_cmd_size) {
+        uint32_t chunk = (pagesize - off > sl->xfer_caps.rw32_cmd_size) ? sl->xfer_caps.rw32_cmd_size : pagesize - off;
         memcpy(sl->q_buf, base + count * pagesize + off, chunk);
         ret = stlink_write_mem32(sl, addr + count * pagesize + off, (uint16_t) chunk);
       }
@@ -650,6 +1242,12 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
              sl->flash_type == STM32_FLASH_TYPE_C0) {
     ILOG("Starting Flash write for WB/G0/G4/L5/U5/H5/C0\n");
 
+    // flash loader initialisation
+    if (stlink_flash_loader_init(sl, fl) == -1) {
+      ELOG("stlink_flash_loader_init() == -1\n");
+      return (-1);
+    }
+
     unlock_flash_if(sl);         // unlock flash if necessary
     set_flash_cr_pg(sl, BANK_1); // set PG 'allow programming' bit
   } else if (sl->flash_type == STM32_FLASH_TYPE_L0_L1) {
@@ -726,29 +1324,158 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
   return (0);
 }
 
+#define FLASH_FAST_ROW_SIZE 256
+
+/*
+ * Program the whole rows at the start of addr..addr+len with FSTPG set, using
+ * flashloaders/stm32l4fast.s placed after the regular loader.
+ * Returns the number of bytes written or -1 on failure.
+ */
+static int32_t stlink_flashloader_write_rows(stlink_t *sl, flash_loader_t *fl, stm32_addr_t addr,
+                                             uint8_t *base, uint32_t len) {
+  flash_loader_t fast = *fl;
+  uint32_t rows = len & ~(FLASH_FAST_ROW_SIZE - 1);
+  uint32_t cr_reg = (sl->flash_type == STM32_FLASH_TYPE_L4) ? FLASH_L4_CR : FLASH_Gx_CR;
+  uint32_t buf_size, off, cr;
+  int32_t ret = 0;
+
+  if (rows == 0 || (addr & (FLASH_FAST_ROW_SIZE - 1))) { return (0); }
+
+  fast.loader_addr = fl->buf_addr;
+  fast.buf_addr = fl->buf_addr + sizeof(loader_code_stm32l4_fast);
+  buf_size = sl->sram_base + sl->sram_size - fast.buf_addr;
+  buf_size = (buf_size > 0x8000) ? 0x8000 : (buf_size & ~(FLASH_FAST_ROW_SIZE - 1));
+
+  if (stlink_write_mem(sl, fast.loader_addr, sizeof(loader_code_stm32l4_fast), loader_code_stm32l4_fast)) {
+    return (-1);
+  }
+
+  ILOG("Fast programming %u bytes by rows\n", rows);
+
+  // PG and FSTPG must not be set together
+  stlink_read_debug32(sl, cr_reg, &cr);
+  cr &= ~(1 << FLASH_L4_CR_PG);
+  stlink_write_debug32(sl, cr_reg, cr | (1 << FLASH_L4_CR_FSTPG));
+
+  for (off = 0; off < rows;) {
+    uint32_t size = rows - off > buf_size ? buf_size : rows - off;
+
+    if (stlink_flash_loader_run(sl, &fast, addr + off, base + off, size) == -1) {
+      ELOG("stlink_flash_loader_run(%#x) failed! == -1\n", (addr + off));
+      ret = -1;
+      break;
+    }
+
+    off += size;
+  }
+
+  // back to standard programming for the rest
+  stlink_write_debug32(sl, cr_reg, cr | (1 << FLASH_L4_CR_PG));
+
+  return (ret ? ret : (int32_t) rows);
+}
+
 int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
   uint32_t off;
 
+  if (sl->flash_mass_erased &&
+      (sl->flash_type == STM32_FLASH_TYPE_L4 || sl->flash_type == STM32_FLASH_TYPE_G4)) {
+    int32_t ret = stlink_flashloader_write_rows(sl, fl, addr, base, len);
+
+    if (ret == -1) {
+      check_flash_error(sl);
+      return (-1);
+    }
+
+    addr += ret;
+    base += ret;
+    len -= ret;
+
+    if (len == 0) { return check_flash_error(sl); }
+  }
+
   if ((sl->flash_type == STM32_FLASH_TYPE_F2_F4) ||
       (sl->flash_type == STM32_FLASH_TYPE_F7) ||
       (sl->flash_type == STM32_FLASH_TYPE_L4)) {
     uint32_t buf_size = (sl->sram_size > 0x8000) ? 0x8000 : 0x4000;
-    for (off = 0; off < len;) {
-      uint32_t size = len - off > buf_size ? buf_size : len - off;
-      if (stlink_flash_loader_run(sl, fl, addr + off, base + off, size) == -1) {
-        ELOG("stlink_flash_loader_run(%#x) failed! == -1\n", (addr + off));
+    uint32_t mbox_buf_size = flash_loader_mailbox_buf_size(sl, fl);
+    uint32_t lz4_chunk = sl->flash_compress ? flash_loader_lz4_chunk_size(sl, fl) : 0;
+
+    if (lz4_chunk) {
+      // send compressed chunks, the loader expands them in SRAM
+      if (stlink_flash_loader_run_lz4(sl, fl, addr, base, len, lz4_chunk) == -1) {
+        ELOG("stlink_flash_loader_run_lz4(%#x) failed! == -1\n", addr);
+        check_flash_error(sl);
+        return (-1);
+      }
+    } else if (len > buf_size && mbox_buf_size) {
+      // more than one chunk: overlap the upload with programming
+      if (stlink_flash_loader_run_mailbox(sl, fl, addr, base, len, mbox_buf_size) == -1) {
+        ELOG("stlink_flash_loader_run_mailbox(%#x) failed! == -1\n", addr);
         check_flash_error(sl);
         return (-1);
       }
+    } else {
+      for (off = 0; off < len;) {
+        uint32_t size = len - off > buf_size ? buf_size : len - off;
+        if (stlink_flash_loader_run(sl, fl, addr + off, base + off, size) == -1) {
+          ELOG("stlink_flash_loader_run(%#x) failed! == -1\n", (addr + off));
+          check_flash_error(sl);
+          return (-1);
+        }
 
-      off += size;
+        off += size;
+      }
     }
   } else if (sl->flash_type == STM32_FLASH_TYPE_WB_WL ||
              sl->flash_type == STM32_FLASH_TYPE_G0 ||
              sl->flash_type == STM32_FLASH_TYPE_G4 ||
              sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5 ||
              sl->flash_type == STM32_FLASH_TYPE_C0) {
-  
+    // L5/U5/H5 program by quad words, the others by double words
+    uint32_t unit = (sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5) ? 16 : 8;
+    uint32_t buf_size = sl->sram_base + sl->sram_size - fl->buf_addr;
+    uint32_t body = len - len % unit;
+
+    buf_size = (buf_size > 0x8000) ? 0x8000 : (buf_size & ~0x3ffu);
+
+    for (off = 0; off < body;) {
+      uint32_t size = body - off > buf_size ? buf_size : body - off;
+
+      if (stlink_flash_loader_run(sl, fl, addr + off, base + off, size) == -1) {
+        if (off == 0) {
+          WLOG("Failed to use flash loader, fallback to soft write\n");
+          break;
+        }
+
+        ELOG("stlink_flash_loader_run(%#x) failed! == -1\n", (addr + off));
+        check_flash_error(sl);
+        return (-1);
+      }
+
+      off += size;
+    }
+
+    if (off == body && body < len) {
+      // program the last partial unit from a copy padded with the erased value
+      uint8_t last[16];
+
+      memset(last, 0xff, sizeof(last));
+      memcpy(last, base + off, len - off);
+
+      if (stlink_flash_loader_run(sl, fl, addr + off, last, unit) == -1) {
+        ELOG("stlink_flash_loader_run(%#x) failed! == -1\n", (addr + off));
+        check_flash_error(sl);
+        return (-1);
+      }
+
+      off = len;
+    }
+
+    if (off == len) {
+      return check_flash_error(sl);
+    }
+
     if (sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5 && (len % 16)) {
         WLOG("Aligning data size to 16 bytes\n");
         len += 16 - len % 16;
@@ -766,7 +1493,7 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
       data = 0;
       memcpy(&data, base + off, (len - off) < 4 ? (len - off) : 4);
       stlink_write_debug32(sl, addr + off, data);
-      wait_flash_busy(sl); // wait for 'busy' bit in FLASH_SR to clear
+      wait_flash_busy_op(sl, STLINK_POLL_PROGRAM, 4); // wait for 'busy' bit in FLASH_SR to clear
     }
     fprintf(stdout, "\n");
 
@@ -847,8 +1574,14 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
       // Program STM32H7x with 64-byte Flash words
       uint32_t chunk = (len - off > 64) ? 64 : len - off;
       memcpy(sl->q_buf, base + off, chunk);
-      stlink_write_mem32(sl, addr + off, 64);
-      wait_flash_busy(sl);
+      memset(sl->q_buf + chunk, 0xff, 64 - chunk);
+
+      if (stlink_write_mem32(sl, addr + off, 64)) {
+        ELOG("Failed to write flash word at %#x\n", addr + off);
+        return (-1);
+      }
+
+      wait_flash_busy_op(sl, STLINK_POLL_PROGRAM, 64);
 
       off += chunk;
 
@@ -14,6 +14,9 @@ int32_t stlink_flash_loader_init(stlink_t *sl, flash_loader_t* fl);
 //                                             const uint8_t *low_v_loader, uint32_t low_v_loader_size);
 int32_t stlink_flash_loader_write_to_sram(stlink_t *sl, stm32_addr_t* addr, uint32_t* size);
 int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t target, const uint8_t* buf, uint32_t size);
+int32_t stlink_flash_loader_load_crc32(stlink_t *sl);
+int32_t stlink_flash_loader_check_crc32(stlink_t *sl, stm32_addr_t addr, const uint8_t *data, uint32_t len);
+int32_t stlink_flash_loader_verify_crc32(stlink_t *sl, stm32_addr_t addr, const uint8_t *data, uint32_t len);
 
 
 /* === Functions from old header file flashloader.h === */
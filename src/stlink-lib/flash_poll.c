@@ -0,0 +1,143 @@
+/*
+ * File: flash_poll.c
+ *
+ * Adaptive polling for flash operations
+ *
+ * Every kind of operation learns how long it takes per KiB of data on the
+ * connected target. A wait sleeps through most of the expected duration,
+ * then polls without delay until a little past it and falls back to polling
+ * once per millisecond after that, so that neither long erases flood the
+ * link with status reads nor short loader runs lose time in a fixed sleep.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stlink.h>
+#include "flash_poll.h"
+
+#include "helper.h"
+#include "logging.h"
+
+#define POLL_TIGHT_MIN_US   2000  // poll without delay at least this long
+#define POLL_SLOW_US        1000  // delay between polls past the expected end
+#define POLL_MIN_SLEEP_US   1000  // shorter sleeps are rounded up by the OS
+
+static const char *const poll_op_names[STLINK_POLL_OPS] = {
+  "other", "page erase", "sector erase", "program", "loader run", "crc32 run"
+};
+
+struct poll_done_arg {
+  bool (*done)(stlink_t *);
+};
+
+static bool poll_call_done(stlink_t *sl, void *arg) {
+  return (((struct poll_done_arg *) arg)->done(sl));
+}
+
+static void poll_record(stlink_poll_stats_t *st, uint32_t size, uint32_t us) {
+  uint32_t n = 0;
+
+  while (n < STLINK_POLL_HIST_BUCKETS - 1 && us >= (64u << n)) { n++; }
+
+  st->hist[n]++;
+
+  if (st->count == 0 || us < st->min_us) { st->min_us = us; }
+
+  if (us > st->max_us) { st->max_us = us; }
+
+  if (size) {
+    uint32_t rate = (uint32_t) (((uint64_t) us * 1024) / size);
+    // moving average, so that one slow run does not throw the model off
+    st->us_per_kb = (st->count == 0) ? rate : (st->us_per_kb * 7 + rate) / 8;
+  }
+
+  st->count++;
+}
+
+/**
+ * Wait for a flash operation to complete
+ * @param sl stlink context
+ * @param op kind of operation, selects the model and statistics
+ * @param size bytes affected by the operation, 0 if it does not scale with size
+ * @param done completion check
+ * @param timeout_ms 0 to wait forever
+ * @return 0 for success, -1 on timeout
+ */
+int32_t stlink_poll_wait(stlink_t *sl, enum stlink_poll_op op, uint32_t size,
+                         bool (*done)(stlink_t *), uint32_t timeout_ms) {
+  struct poll_done_arg arg = { done };
+
+  return (stlink_poll_wait_since(sl, op, size, time_us(), poll_call_done, &arg, timeout_ms));
+}
+
+/**
+ * Wait for a flash operation that started before the call, e.g. one of
+ * several that run at the same time
+ * @param start time_us() when the operation started
+ * @param done completion check, called with arg
+ * @see stlink_poll_wait()
+ */
+int32_t stlink_poll_wait_since(stlink_t *sl, enum stlink_poll_op op, uint32_t size, uint32_t start,
+                               bool (*done)(stlink_t *, void *), void *arg, uint32_t timeout_ms) {
+  stlink_poll_stats_t *st = &sl->poll_stats[op];
+  uint32_t expected = 0, tight, elapsed;
+
+  if (st->count && size) {
+    expected = (uint32_t) (((uint64_t) st->us_per_kb * size) / 1024);
+  }
+
+  // sleep until three quarters of the expected duration have passed
+  elapsed = time_us() - start;
+
+  if (expected - expected / 4 >= elapsed + POLL_MIN_SLEEP_US) {
+    usleep(expected - expected / 4 - elapsed);
+  }
+
+  tight = expected + expected / 4;
+
+  if (tight < POLL_TIGHT_MIN_US) { tight = POLL_TIGHT_MIN_US; }
+
+  while (!done(sl, arg)) {
+    elapsed = time_us() - start;
+
+    if (timeout_ms && elapsed / 1000 >= timeout_ms) {
+      DLOG("%s timed out after %u ms\n", poll_op_names[op], elapsed / 1000);
+      return (-1);
+    }
+
+    if (elapsed >= tight) { usleep(POLL_SLOW_US); }
+  }
+
+  poll_record(st, size, time_us() - start);
+  return (0);
+}
+
+const stlink_poll_stats_t *stlink_poll_get_stats(stlink_t *sl, enum stlink_poll_op op) {
+  return (&sl->poll_stats[op]);
+}
+
+void stlink_poll_log_stats(stlink_t *sl) {
+  uint32_t op, n;
+
+  for (op = 0; op < STLINK_POLL_OPS; op++) {
+    const stlink_poll_stats_t *st = &sl->poll_stats[op];
+
+    if (st->count == 0) { continue; }
+
+    DLOG("%-12s: %u waits, %u..%u us, %u us/KiB\n", poll_op_names[op],
+         st->count, st->min_us, st->max_us, st->us_per_kb);
+
+    for (n = 0; n < STLINK_POLL_HIST_BUCKETS; n++) {
+      if (st->hist[n] == 0) { continue; }
+
+      if (n == STLINK_POLL_HIST_BUCKETS - 1) {
+        DLOG("  >= %7u us: %u\n", 64u << (n - 1), st->hist[n]);
+      } else {
+        DLOG("  <  %7u us: %u\n", 64u << n, st->hist[n]);
+      }
+    }
+  }
+}
@@ -0,0 +1,17 @@
+/*
+ * File: flash_poll.h
+ *
+ * Adaptive polling for flash operations
+ */
+
+#ifndef FLASH_POLL_H
+#define FLASH_POLL_H
+
+int32_t stlink_poll_wait(stlink_t *sl, enum stlink_poll_op op, uint32_t size,
+                         bool (*done)(stlink_t *), uint32_t timeout_ms);
+int32_t stlink_poll_wait_since(stlink_t *sl, enum stlink_poll_op op, uint32_t size, uint32_t start,
+                               bool (*done)(stlink_t *, void *), void *arg, uint32_t timeout_ms);
+const stlink_poll_stats_t *stlink_poll_get_stats(stlink_t *sl, enum stlink_poll_op op);
+void stlink_poll_log_stats(stlink_t *sl);
+
+#endif // FLASH_POLL_H
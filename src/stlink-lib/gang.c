@@ -0,0 +1,149 @@
+/*
+ * File: gang.c
+ *
+ * Program several ST-Links at once
+ *
+ * Every probe gets its own thread that opens it, connects to the target,
+ * runs the job and closes it again. The job argument is shared by all
+ * threads and must be treated as read only, e.g. an image mapped once.
+ * The chip descriptions have to be loaded with init_chipids() before.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif // _WIN32
+
+#include <stlink.h>
+#include "gang.h"
+
+#include "helper.h"
+#include "logging.h"
+#include "usb.h"
+
+struct gang_worker {
+    stlink_gang_result_t *result;
+    enum ugly_loglevel verbose;
+    enum connect_type connect;
+    int32_t freq;
+    stlink_gang_job_t job;
+    void *arg;
+};
+
+static void gang_worker_run(struct gang_worker *w) {
+    stlink_gang_result_t *res = w->result;
+    uint32_t start = time_ms();
+    stlink_t *sl;
+
+    // tell the messages of the probes apart
+    ugly_set_prefix(res->serial);
+
+    sl = stlink_open_usb(w->verbose, w->connect, res->serial, w->freq);
+    res->err = -1;
+
+    if (sl == NULL) {
+        ELOG("Failed to open the probe\n");
+    } else if (sl->flash_type == STM32_FLASH_TYPE_UNKNOWN) {
+        ELOG("Failed to connect to target\n");
+    } else if (stlink_force_debug(sl) || stlink_status(sl)) {
+        ELOG("Failed to halt the core\n");
+    } else {
+        res->chip_id = sl->chip_id;
+        res->err = w->job(sl, w->arg);
+    }
+
+    if (sl != NULL) {
+        stlink_exit_debug_mode(sl);
+        stlink_close(sl);
+    }
+
+    res->elapsed_ms = time_ms() - start;
+    ugly_set_prefix(NULL);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI gang_thread(LPVOID arg) {
+    gang_worker_run(arg);
+    return (0);
+}
+#else
+static void *gang_thread(void *arg) {
+    gang_worker_run(arg);
+    return (NULL);
+}
+#endif // _WIN32
+
+/**
+ * Run a job on several probes in parallel, one thread per probe
+ * @param results one entry per probe with the serial filled in, receives the outcome
+ * @param count number of probes
+ * @param verbose log level of the probe threads
+ * @param connect how to connect to the targets
+ * @param freq SWD frequency
+ * @param job work done on every connected and halted target
+ * @param arg passed to every job
+ * @return number of probes that failed, -1 if the threads could not be started
+ */
+int32_t stlink_gang_run(stlink_gang_result_t *results, uint32_t count, enum ugly_loglevel verbose,
+                        enum connect_type connect, int32_t freq, stlink_gang_job_t job, void *arg) {
+    struct gang_worker *workers = calloc(count, sizeof(*workers));
+#if defined(_WIN32)
+    HANDLE *threads = calloc(count, sizeof(*threads));
+#else
+    pthread_t *threads = calloc(count, sizeof(*threads));
+#endif // _WIN32
+    uint32_t started, i;
+    int32_t failed = 0;
+
+    if (workers == NULL || threads == NULL) {
+        free(workers);
+        free(threads);
+        return (-1);
+    }
+
+    for (started = 0; started < count; started++) {
+        struct gang_worker *w = &workers[started];
+
+        w->result = &results[started];
+        w->verbose = verbose;
+        w->connect = connect;
+        w->freq = freq;
+        w->job = job;
+        w->arg = arg;
+        w->result->err = -1;
+        w->result->chip_id = 0;
+        w->result->elapsed_ms = 0;
+
+#if defined(_WIN32)
+        threads[started] = CreateThread(NULL, 0, gang_thread, w, 0, NULL);
+        if (threads[started] == NULL) { break; }
+#else
+        if (pthread_create(&threads[started], NULL, gang_thread, w)) { break; }
+#endif // _WIN32
+    }
+
+    if (started < count) { ELOG("Could only start %u of %u probe threads\n", started, count); }
+
+    for (i = 0; i < started; i++) {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif // _WIN32
+    }
+
+    for (i = 0; i < count; i++) {
+        if (results[i].err != 0) { failed++; }
+    }
+
+    free(workers);
+    free(threads);
+
+    return ((started < count) ? -1 : failed);
+}
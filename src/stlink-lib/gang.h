@@ -0,0 +1,24 @@
+/*
+ * File: gang.h
+ *
+ * Program several ST-Links at once
+ */
+
+#ifndef GANG_H
+#define GANG_H
+
+/* Outcome of the job on one probe */
+typedef struct stlink_gang_result {
+    char serial[STLINK_SERIAL_BUFFER_SIZE];
+    int32_t err;          // return value of the job, -1 if the target could not be connected
+    uint32_t chip_id;
+    uint32_t elapsed_ms;  // connect, job and disconnect
+} stlink_gang_result_t;
+
+/* Work done on every probe, runs in the thread of that probe */
+typedef int32_t (*stlink_gang_job_t)(stlink_t *sl, void *arg);
+
+int32_t stlink_gang_run(stlink_gang_result_t *results, uint32_t count, enum ugly_loglevel verbose,
+                        enum connect_type connect, int32_t freq, stlink_gang_job_t job, void *arg);
+
+#endif // GANG_H
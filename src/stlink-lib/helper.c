@@ -22,6 +22,12 @@ uint32_t time_ms() {
     return (uint32_t) (tv.tv_sec * 1000 + tv.tv_usec / 1000);
 }
 
+uint32_t time_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint32_t) (tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
 int32_t arg_parse_freq(const char *str) {
     int32_t value = -1;
     if (str != NULL) {
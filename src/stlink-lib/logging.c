@@ -14,13 +14,29 @@
 
 #include "logging.h"
 
-static int32_t max_level = UDEBUG;
+#if defined(_MSC_VER)
+#define UGLY_THREAD_LOCAL __declspec(thread)
+#else
+#define UGLY_THREAD_LOCAL _Thread_local
+#endif
+
+/*
+ * Level and prefix are per thread: stlink_open_usb() sets the level of the
+ * thread that opens a probe, so probes served by different threads don't race
+ */
+static UGLY_THREAD_LOCAL int32_t max_level = UDEBUG;
+static UGLY_THREAD_LOCAL const char *log_prefix = NULL;
 
 int32_t ugly_init(int32_t maximum_threshold) {
   max_level = maximum_threshold;
   return (0);
 }
 
+// tag the messages of the calling thread, e.g. with the serial of its probe
+void ugly_set_prefix(const char *prefix) {
+  log_prefix = prefix;
+}
+
 int32_t ugly_log(int32_t level, const char *tag, const char *format, ...) {
   if (level > max_level) {
     return (0);
@@ -45,6 +61,13 @@ int32_t ugly_log(int32_t level, const char *tag, const char *format, ...) {
   ptt = localtime(&mytt);
 #endif
 
+  // keep the parts of one message together when several threads log
+#if defined(_WIN32)
+  _lock_file(stderr);
+#else
+  flockfile(stderr);
+#endif
+
   fprintf(stderr, "%d-%02d-%02dT%02d:%02d:%02d ", ptt->tm_year + 1900,
           ptt->tm_mon + 1, ptt->tm_mday, ptt->tm_hour, ptt->tm_min, ptt->tm_sec);
 
@@ -66,8 +89,15 @@ int32_t ugly_log(int32_t level, const char *tag, const char *format, ...) {
     break;
   }
 
+  if (log_prefix != NULL) { fprintf(stderr, "[%s] ", log_prefix); }
+
   vfprintf(stderr, format, args);
   fflush(stderr);
+#if defined(_WIN32)
+  _unlock_file(stderr);
+#else
+  funlockfile(stderr);
+#endif
   va_end(args);
   return (1);
 }
@@ -32,6 +32,7 @@ enum ugly_loglevel {
 #endif // __GNUC__
 
 int32_t ugly_init(int32_t maximum_threshold);
+void ugly_set_prefix(const char *prefix);
 int32_t ugly_log(int32_t level, const char *tag, const char *format, ...) PRINTF_ARRT;
 int32_t ugly_libusb_log_level(enum ugly_loglevel v);
 
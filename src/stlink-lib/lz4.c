@@ -0,0 +1,122 @@
+/*
+ * File: lz4.c
+ *
+ * LZ4 block compression for the compressing flash loader
+ *
+ * A greedy single pass compressor producing the standard LZ4 block format,
+ * expanded on the target by flashloaders/stm32lz4.s. Firmware images mostly
+ * gain from runs of the erased value and repeated tables, which a hash of
+ * the next four bytes finds without searching.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <stlink.h>
+#include "lz4.h"
+
+#include "read_write.h"
+
+#define LZ4_HASH_BITS      12
+#define LZ4_MIN_MATCH      4
+#define LZ4_LAST_LITERALS  5   // the block ends with at least this many literals
+#define LZ4_MF_LIMIT       12  // no match starts this close to the end
+#define LZ4_MAX_OFFSET     0xffff
+
+static uint32_t lz4_hash(const uint8_t *p) {
+  return ((read_uint32(p, 0) * 2654435761u) >> (32 - LZ4_HASH_BITS));
+}
+
+// length beyond the 4 bits of the token, as bytes of 255 and a remainder
+static uint8_t *lz4_put_length(uint8_t *op, const uint8_t *oend, uint32_t len) {
+  for (; len >= 255; len -= 255) {
+    if (op >= oend) { return (NULL); }
+
+    *op++ = 255;
+  }
+
+  if (op >= oend) { return (NULL); }
+
+  *op++ = (uint8_t) len;
+  return (op);
+}
+
+// one sequence: token, literals and, unless it is the last one, the match
+static uint8_t *lz4_put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, uint32_t nlit,
+                                 uint32_t offset, uint32_t mlen) {
+  uint8_t *token = op++;
+
+  if (op > oend) { return (NULL); }
+
+  *token = (uint8_t) (((nlit < 15) ? nlit : 15) << 4);
+
+  if (nlit >= 15 && (op = lz4_put_length(op, oend, nlit - 15)) == NULL) { return (NULL); }
+
+  if ((uint32_t) (oend - op) < nlit) { return (NULL); }
+
+  memcpy(op, lit, nlit);
+  op += nlit;
+
+  if (mlen == 0) { return (op); }
+
+  if (oend - op < 2) { return (NULL); }
+
+  *op++ = (uint8_t) offset;
+  *op++ = (uint8_t) (offset >> 8);
+  mlen -= LZ4_MIN_MATCH;
+  *token |= (uint8_t) ((mlen < 15) ? mlen : 15);
+
+  if (mlen >= 15) { op = lz4_put_length(op, oend, mlen - 15); }
+
+  return (op);
+}
+
+/**
+ * Compress a buffer into one LZ4 block
+ * @param src data to compress
+ * @param len size of the data
+ * @param dst receives the block
+ * @param cap size of dst, STLINK_LZ4_BOUND(len) always suffices
+ * @return size of the block, 0 if it does not fit into cap
+ */
+uint32_t stlink_lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+  uint32_t table[1 << LZ4_HASH_BITS]; // last position + 1 of each hash, 0 for none
+  const uint8_t *ip = src, *anchor = src, *iend = src + len;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  memset(table, 0, sizeof(table));
+
+  while (len > LZ4_MF_LIMIT && ip < iend - LZ4_MF_LIMIT) {
+    uint32_t h = lz4_hash(ip);
+    uint32_t pos = table[h];
+    uint32_t mlen = LZ4_MIN_MATCH;
+    const uint8_t *ref;
+
+    table[h] = (uint32_t) (ip - src) + 1;
+
+    if (pos == 0) {
+      ip++;
+      continue;
+    }
+
+    ref = src + pos - 1;
+
+    if (ip - ref > LZ4_MAX_OFFSET || read_uint32(ref, 0) != read_uint32(ip, 0)) {
+      ip++;
+      continue;
+    }
+
+    while (ip + mlen < iend - LZ4_LAST_LITERALS && ref[mlen] == ip[mlen]) { mlen++; }
+
+    op = lz4_put_sequence(op, oend, anchor, (uint32_t) (ip - anchor), (uint32_t) (ip - ref), mlen);
+
+    if (op == NULL) { return (0); }
+
+    ip += mlen;
+    anchor = ip;
+  }
+
+  op = lz4_put_sequence(op, oend, anchor, (uint32_t) (iend - anchor), 0, 0);
+
+  return ((op == NULL) ? 0 : (uint32_t) (op - dst));
+}
@@ -0,0 +1,14 @@
+/*
+ * File: lz4.h
+ *
+ * LZ4 block compression for the compressing flash loader
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#define STLINK_LZ4_BOUND(n) ((n) + (n) / 255 + 16)
+
+uint32_t stlink_lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap);
+
+#endif // LZ4_H
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <fcntl.h>
@@ -21,45 +22,43 @@
 #define O_BINARY 0
 #endif
 
-// 1 GB max file size
+// largest file that fits the 32 bit length of a mapping
 #ifndef MAX_FILE_SIZE
-#define MAX_FILE_SIZE (1<<20)
+#define MAX_FILE_SIZE ((uint64_t) (SIZE_MAX < UINT32_MAX ? SIZE_MAX : UINT32_MAX))
 #endif
 
-/* Limit the block size to compare to 0x1800 as anything larger will stall the
- * STLINK2 Maybe STLINK V1 needs smaller value!
+/* Compare in blocks of the largest size the connected ST-LINK can read at once.
+ * This is a read-only check: unlike the write paths it must not run the crc32
+ * routine, which would overwrite SRAM and the core registers of the target.
  */
 int32_t check_file(stlink_t *sl, mapped_file_t *mf, stm32_addr_t addr) {
   uint32_t off;
-  uint32_t n_cmp = sl->flash_pgsz;
+  uint32_t n_cmp = sl->xfer_caps.block_size;
+  int32_t error = 0;
 
-  if (n_cmp > 0x1800) {
-    n_cmp = 0x1800;
+  // read back straight into a local buffer instead of through q_buf
+  uint8_t *buf = malloc(n_cmp);
+
+  if (buf == NULL) {
+    return (-1);
   }
 
   for (off = 0; off < mf->len; off += n_cmp) {
-    uint32_t aligned_size;
-
     uint32_t cmp_size = n_cmp; // adjust last page size
 
     if ((off + n_cmp) > mf->len) {
       cmp_size = mf->len - off;
     }
 
-    aligned_size = cmp_size;
-
-    if (aligned_size & (4 - 1)) {
-      aligned_size = (cmp_size + 4) & ~(4 - 1);
-    }
-
-    stlink_read_mem32(sl, addr + off, (uint16_t) aligned_size);
-
-    if (memcmp(sl->q_buf, mf->base + off, cmp_size)) {
-      return (-1);
+    if (stlink_read_mem(sl, addr + off, cmp_size, buf) ||
+        memcmp(buf, mf->base + off, cmp_size)) {
+      error = -1;
+      break;
     }
   }
 
-  return (0);
+  free(buf);
+  return (error);
 }
 
 int32_t map_file(mapped_file_t *mf, const char *path) {
@@ -78,13 +77,10 @@ int32_t map_file(mapped_file_t *mf, const char *path) {
     goto on_error;
   }
 
-  if (sizeof(st.st_size) != sizeof(size_t)) {
-    // on 32 bit systems, check if there is an overflow
-    if (st.st_size > (off_t) MAX_FILE_SIZE  /*1 GB*/ ) {
-      // limit file size to 1 GB
-      fprintf(stderr, "mmap() uint32_t overflow for file %s\n", path);
-      goto on_error;
-    }
+  // off_t may be wider than size_t and mf->len, check for an overflow
+  if ((uint64_t) st.st_size > MAX_FILE_SIZE) {
+    fprintf(stderr, "mmap() uint32_t overflow for file %s\n", path);
+    goto on_error;
   }
 
   mf->base =
@@ -117,8 +117,10 @@ static int32_t stlink_write_option_bytes_f0(stlink_t *sl, stm32_addr_t addr, uin
   WLOG("Erasing option bytes\n");
 
   /* erase option bytes */
-  stlink_write_debug32(sl, FLASH_CR, (1 << FLASH_CR_OPTER) | (1 << FLASH_CR_OPTWRE));
-  ret = stlink_write_debug32(sl, FLASH_CR, (1 << FLASH_CR_OPTER) | (1 << FLASH_CR_STRT) | (1 << FLASH_CR_OPTWRE));
+  ret = stlink_write_debug32(sl, FLASH_CR, (1 << FLASH_CR_OPTER) | (1 << FLASH_CR_OPTWRE));
+  if (ret == 0) {
+    ret = stlink_write_debug32(sl, FLASH_CR, (1 << FLASH_CR_OPTER) | (1 << FLASH_CR_STRT) | (1 << FLASH_CR_OPTWRE));
+  }
   if (ret) {
     return ret;
   }
@@ -538,12 +540,13 @@ static int32_t stlink_write_option_bytes_gx(stlink_t *sl, stm32_addr_t addr, uin
 
   write_uint32((unsigned char *)&data, *(uint32_t *)(base));
   WLOG("Writing option bytes %#10x to %#10x\n", data, addr);
-  stlink_write_debug32(sl, FLASH_Gx_OPTR, data);
-
-  // Set Options Start bit
   stlink_read_debug32(sl, FLASH_Gx_CR, &val);
-  val |= (1 << FLASH_Gx_CR_OPTSTRT);
-  stlink_write_debug32(sl, FLASH_Gx_CR, val);
+
+  // write the option register, then set Options Start bit
+  if ((ret = stlink_write_debug32(sl, FLASH_Gx_OPTR, data)) ||
+      (ret = stlink_write_debug32(sl, FLASH_Gx_CR, val | (1 << FLASH_Gx_CR_OPTSTRT)))) {
+    return (ret);
+  }
 
   wait_flash_busy(sl);
 
@@ -689,12 +692,13 @@ static int32_t stlink_write_option_bytes_l4(stlink_t *sl, stm32_addr_t addr, uin
   uint32_t data;
   write_uint32((unsigned char *)&data, *(uint32_t *)(base));
   WLOG("Writing option bytes 0x%04x\n", data);
-  stlink_write_debug32(sl, FLASH_L4_OPTR, data);
-
-  // set options start bit
   stlink_read_debug32(sl, FLASH_L4_CR, &val);
-  val |= (1 << FLASH_L4_CR_OPTSTRT);
-  stlink_write_debug32(sl, FLASH_L4_CR, val);
+
+  // write the option register, then set options start bit
+  if ((ret = stlink_write_debug32(sl, FLASH_L4_OPTR, data)) ||
+      (ret = stlink_write_debug32(sl, FLASH_L4_CR, val | (1 << FLASH_L4_CR_OPTSTRT)))) {
+    return (ret);
+  }
 
   wait_flash_busy(sl);
   ret = check_flash_error(sl);
@@ -0,0 +1,153 @@
+/*
+ * File: param_cache.c
+ *
+ * On-disk cache of the device parameters
+ *
+ * When the environment variable STLINK_PARAM_CACHE names a directory, the
+ * parameters resolved by stlink_load_device_params() are kept there in one
+ * file per probe serial. On the next connection the cached target is
+ * confirmed by reading its DBGMCU_IDCODE and, in stlink_load_device_params(),
+ * its flash size register, instead of reading the CPUID and the option
+ * registers again. Parts with the same IDCODE differ in flash size, and on
+ * some of them the SRAM size follows from it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <stlink.h>
+#include "param_cache.h"
+
+#include "logging.h"
+#include "read_write.h"
+
+#define PARAM_CACHE_VERSION 1
+
+/* The fields of stlink_t kept in the cache, all of them 32 bit wide */
+static const struct {
+  const char *key;
+  size_t offset;
+} param_cache_fields[] = {
+  { "core_id", offsetof(stlink_t, core_id) },
+  { "idcode_addr", offsetof(stlink_t, idcode_addr) },
+  { "idcode", offsetof(stlink_t, idcode) },
+  { "chip_id", offsetof(stlink_t, chip_id) },
+  { "flash_type", offsetof(stlink_t, flash_type) },
+  { "flash_base", offsetof(stlink_t, flash_base) },
+  { "flash_size", offsetof(stlink_t, flash_size) },
+  { "flash_pgsz", offsetof(stlink_t, flash_pgsz) },
+  { "sram_base", offsetof(stlink_t, sram_base) },
+  { "sram_size", offsetof(stlink_t, sram_size) },
+  { "option_base", offsetof(stlink_t, option_base) },
+  { "option_size", offsetof(stlink_t, option_size) },
+  { "sys_base", offsetof(stlink_t, sys_base) },
+  { "sys_size", offsetof(stlink_t, sys_size) },
+  { "chip_flags", offsetof(stlink_t, chip_flags) },
+  { "otp_base", offsetof(stlink_t, otp_base) },
+  { "otp_size", offsetof(stlink_t, otp_size) },
+};
+
+#define PARAM_CACHE_FIELDS STLINK_ARRAY_SIZE(param_cache_fields)
+
+static uint32_t *param_cache_field(stlink_t *sl, uint32_t i) {
+  return ((uint32_t *)((uint8_t *)sl + param_cache_fields[i].offset));
+}
+
+// cache file of the probe, -1 if caching is off or the probe has no serial
+static int32_t param_cache_path(stlink_t *sl, char *path, size_t size) {
+  const char *dir = getenv(STLINK_PARAM_CACHE_ENV);
+
+  if (dir == NULL || dir[0] == '\0' || sl->serial[0] == '\0') { return (-1); }
+
+  snprintf(path, size, "%s/%s.params", dir, sl->serial);
+  return (0);
+}
+
+/**
+ * Take the device parameters from the cache if the connected target matches
+ * @param sl stlink context, core_id read already
+ * @return 0 if the parameters were loaded, -1 to run the full discovery
+ */
+int32_t stlink_param_cache_load(stlink_t *sl) {
+  uint32_t values[PARAM_CACHE_FIELDS];
+  uint32_t found = 0, version = 0, value, idcode, i;
+  char path[1024], key[64];
+  FILE *fp;
+
+  if (param_cache_path(sl, path, sizeof(path)) || (fp = fopen(path, "r")) == NULL) { return (-1); }
+
+  while (fscanf(fp, "%63s %" SCNx32, key, &value) == 2) {
+    if (strcmp(key, "version") == 0) {
+      version = value;
+      continue;
+    }
+
+    for (i = 0; i < PARAM_CACHE_FIELDS; i++) {
+      if (strcmp(key, param_cache_fields[i].key) == 0) {
+        values[i] = value;
+        found |= 1u << i;
+      }
+    }
+  }
+
+  fclose(fp);
+
+  if (version != PARAM_CACHE_VERSION || found != (1u << PARAM_CACHE_FIELDS) - 1) {
+    DLOG("Parameter cache %s is incomplete\n", path);
+    return (-1);
+  }
+
+  // the core and the single validation read have to match the cached target
+  if (values[0] != sl->core_id || stlink_read_debug32(sl, values[1], &idcode) || idcode != values[2]) {
+    DLOG("Parameter cache %s is for another target\n", path);
+    return (-1);
+  }
+
+  for (i = 0; i < PARAM_CACHE_FIELDS; i++) { *param_cache_field(sl, i) = values[i]; }
+
+  DLOG("Device parameters taken from %s\n", path);
+  return (0);
+}
+
+/**
+ * Save the device parameters just loaded for the next connection
+ * @param sl stlink context, after stlink_load_device_params()
+ */
+void stlink_param_cache_store(stlink_t *sl) {
+  char path[1024], tmp[1040];
+  FILE *fp;
+
+  if (param_cache_path(sl, path, sizeof(path))) { return; }
+
+  // write a new file and replace the old one, a concurrent reader never sees half a file
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if ((fp = fopen(tmp, "w")) == NULL) {
+    WLOG("Cannot write parameter cache %s\n", tmp);
+    return;
+  }
+
+  fprintf(fp, "version %x\n", PARAM_CACHE_VERSION);
+
+  for (uint32_t i = 0; i < PARAM_CACHE_FIELDS; i++) {
+    fprintf(fp, "%s %" PRIx32 "\n", param_cache_fields[i].key, *param_cache_field(sl, i));
+  }
+
+  if (fclose(fp) != 0) {
+    remove(tmp);
+    return;
+  }
+
+#if defined(_WIN32)
+  remove(path); // rename() does not replace files on Windows
+#endif
+
+  if (rename(tmp, path) != 0) {
+    WLOG("Cannot write parameter cache %s\n", path);
+    remove(tmp);
+  }
+}
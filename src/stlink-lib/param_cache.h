@@ -0,0 +1,15 @@
+/*
+ * File: param_cache.h
+ *
+ * On-disk cache of the device parameters
+ */
+
+#ifndef PARAM_CACHE_H
+#define PARAM_CACHE_H
+
+#define STLINK_PARAM_CACHE_ENV "STLINK_PARAM_CACHE"
+
+int32_t stlink_param_cache_load(stlink_t *sl);
+void stlink_param_cache_store(stlink_t *sl);
+
+#endif // PARAM_CACHE_H
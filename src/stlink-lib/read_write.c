@@ -12,6 +12,7 @@
 #include "read_write.h"
 
 #include "logging.h"
+#include "register.h"
 
 // Endianness
 // https://commandcenter.blogspot.com/2012/04/byte-order-fallacy.html
@@ -53,6 +54,99 @@ int32_t stlink_write_debug32(stlink_t *sl, uint32_t addr, uint32_t data) {
   return sl->backend->write_debug32(sl, addr, data);
 }
 
+/*
+ * Debug register command queue
+ *
+ * Sequences of 32-bit register accesses which don't depend on each other's results
+ * (register selects and reads, ...) can be recorded with
+ * stlink_debug32_queue_read()/stlink_debug32_queue_write() and sent as one burst
+ * by stlink_debug32_flush(). Read results are stored to the caller's slots on flush.
+ * The accesses are executed in order, but a failed access doesn't stop the ones
+ * queued behind it, and after a WAIT reply the rest of the burst may be executed
+ * a second time. Only queue accesses which may be repeated, never unlock keys or
+ * a setup followed by a start bit.
+ */
+void stlink_debug32_begin(stlink_t *sl) {
+  sl->debug32_queue_len = 0;
+}
+
+static int32_t stlink_debug32_queue(stlink_t *sl, uint32_t addr, uint32_t data, uint32_t *result, int32_t *error) {
+  int32_t ret = 0;
+
+  // queue is full, send what we have so far
+  if (sl->debug32_queue_len == STLINK_DEBUG32_QUEUE_LEN) { ret = stlink_debug32_flush(sl); }
+
+  stlink_debug32_op_t *op = &sl->debug32_queue[sl->debug32_queue_len++];
+  op->addr = addr;
+  op->data = data;
+  op->result = result;
+  op->error = error;
+  op->status = 0;
+
+  return (ret);
+}
+
+int32_t stlink_debug32_queue_read(stlink_t *sl, uint32_t addr, uint32_t *data, int32_t *error) {
+  // a NULL slot would turn the access into a write
+  if (data == NULL) {
+    if (error) { *error = -1; }
+
+    return (-1);
+  }
+
+  return (stlink_debug32_queue(sl, addr, 0, data, error));
+}
+
+int32_t stlink_debug32_queue_write(stlink_t *sl, uint32_t addr, uint32_t data, int32_t *error) {
+  return (stlink_debug32_queue(sl, addr, data, NULL, error));
+}
+
+/**
+ * Execute all queued debug register accesses
+ * @param sl
+ * @return 0 if all accesses succeeded, -1 if at least one failed.
+ */
+int32_t stlink_debug32_flush(stlink_t *sl) {
+  uint32_t count = sl->debug32_queue_len;
+  int32_t ret = 0;
+
+  if (count == 0) { return (0); }
+
+  sl->debug32_queue_len = 0;
+
+  if (sl->backend->debug32_batch) {
+    DLOG("*** stlink_debug32_flush %u accesses\n", count);
+    sl->backend->debug32_batch(sl, sl->debug32_queue, count);
+  } else {
+    for (uint32_t i = 0; i < count; i++) {
+      stlink_debug32_op_t *op = &sl->debug32_queue[i];
+
+      if (op->result) {
+        op->status = sl->backend->read_debug32(sl, op->addr, op->result);
+      } else {
+        op->status = sl->backend->write_debug32(sl, op->addr, op->data);
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    stlink_debug32_op_t *op = &sl->debug32_queue[i];
+
+    if (op->status) {
+      DLOG("*** stlink_debug32_flush: access %u to %#010x failed\n", i, op->addr);
+      ret = -1;
+    } else if (op->result) {
+      DLOG("*** stlink_read_debug32  %#010x at %#010x\n", *op->result, op->addr);
+    } else {
+      DLOG("*** stlink_write_debug32 %#010x to %#010x\n", op->data, op->addr);
+    }
+
+    if (op->error) { *op->error = op->status ? -1 : 0; }
+  }
+
+  return (ret);
+}
+
 int32_t stlink_read_mem32(stlink_t *sl, uint32_t addr, uint16_t len) {
   DLOG("*** stlink_read_mem32 ***\n");
 
@@ -75,6 +169,86 @@ int32_t stlink_write_mem32(stlink_t *sl, uint32_t addr, uint16_t len) {
   return (sl->backend->write_mem32(sl, addr, len));
 }
 
+/**
+ * Read memory of any size and alignment into a caller provided buffer
+ * @param sl
+ * @param addr target address
+ * @param len number of bytes
+ * @param dst destination, at least len bytes
+ * @return 0 on success, -1 on failure.
+ */
+int32_t stlink_read_mem(stlink_t *sl, uint32_t addr, uint32_t len, uint8_t *dst) {
+  DLOG("*** stlink_read_mem %u bytes from %#x\n", len, addr);
+
+  if (sl->backend->read_mem) {
+    return (sl->backend->read_mem(sl, addr, len, dst));
+  }
+
+  // backend without direct transfers: go through q_buf by aligned blocks
+  while (len) {
+    uint32_t head = addr & 3;
+    uint32_t size = head + len;
+
+    if (size > sl->xfer_caps.block_size) { size = sl->xfer_caps.block_size; }
+
+    if (sl->backend->read_mem32(sl, addr - head, (uint16_t) ((size + 3) & ~3u))) { return (-1); }
+
+    size -= head;
+    memcpy(dst, sl->q_buf + head, size);
+    addr += size;
+    dst += size;
+    len -= size;
+  }
+
+  return (0);
+}
+
+/**
+ * Write memory of any size and alignment from a caller provided buffer
+ * @param sl
+ * @param addr target address
+ * @param len number of bytes
+ * @param src source, at least len bytes
+ * @return 0 on success, -1 on failure.
+ */
+int32_t stlink_write_mem(stlink_t *sl, uint32_t addr, uint32_t len, const uint8_t *src) {
+  DLOG("*** stlink_write_mem %u bytes to %#x\n", len, addr);
+
+  if (sl->backend->write_mem) {
+    return (sl->backend->write_mem(sl, addr, len, src));
+  }
+
+  // backend without direct transfers: go through q_buf, bytes up to alignment
+  while (len) {
+    uint32_t size;
+    int32_t ret;
+
+    if ((addr & 3) || len < 4) {
+      size = 4 - (addr & 3);
+
+      if (size > len) { size = len; }
+
+      memcpy(sl->q_buf, src, size);
+      ret = sl->backend->write_mem8(sl, addr, (uint16_t) size);
+    } else {
+      size = len & ~3u;
+
+      if (size > sl->xfer_caps.block_size) { size = sl->xfer_caps.block_size; }
+
+      memcpy(sl->q_buf, src, size);
+      ret = sl->backend->write_mem32(sl, addr, (uint16_t) size);
+    }
+
+    if (ret) { return (-1); }
+
+    addr += size;
+    src += size;
+    len -= size;
+  }
+
+  return (0);
+}
+
 int32_t stlink_write_mem8(stlink_t *sl, uint32_t addr, uint16_t len) {
   DLOG("*** stlink_write_mem8 ***\n");
   return (sl->backend->write_mem8(sl, addr, len));
@@ -148,7 +322,54 @@ int32_t stlink_read_all_regs(stlink_t *sl, struct stlink_reg *regp) {
   return (sl->backend->read_all_regs(sl, regp));
 }
 
+/*
+ * Special and FP registers through the debug32 queue: every DCRSR select is
+ * followed by a DHCSR and the DCRDR read, all 34 registers go out in a few
+ * bursts instead of two USB transactions per register. A slowly clocked core
+ * may not have finished the transfer by the time DCRDR is read, then
+ * DHCSR.S_REGRDY is still clear and the registers are read one by one.
+ */
+static int32_t stlink_read_all_unsupported_regs_batched(stlink_t *sl, struct stlink_reg *regp) {
+  uint32_t values[34], dhcsr[34];
+  int32_t ret = 0;
+
+  stlink_debug32_begin(sl);
+
+  for (uint32_t i = 0; i < 34; i++) {
+    // CONTROL/FAULTMASK/BASEPRI/PRIMASK, FPSCR, then S0..S31
+    uint32_t sel = (i == 0) ? 0x14 : ((i == 1) ? 0x21 : 0x40 + i - 2);
+
+    ret |= stlink_debug32_queue_write(sl, STLINK_REG_DCRSR, sel, NULL);
+    ret |= stlink_debug32_queue_read(sl, STLINK_REG_DHCSR, &dhcsr[i], NULL);
+    ret |= stlink_debug32_queue_read(sl, STLINK_REG_DCRDR, &values[i], NULL);
+  }
+
+  ret |= stlink_debug32_flush(sl);
+
+  if (ret) { return (-1); }
+
+  for (uint32_t i = 0; i < 34; i++) {
+    if (!(dhcsr[i] & STLINK_REG_DHCSR_S_REGRDY)) {
+      DLOG("register transfer %u not ready, reading the registers one by one\n", i);
+      return (sl->backend->read_all_unsupported_regs(sl, regp));
+    }
+  }
+
+  regp->primask = (uint8_t) (values[0] & 0xFF);
+  regp->basepri = (uint8_t) ((values[0] >> 8) & 0xFF);
+  regp->faultmask = (uint8_t) ((values[0] >> 16) & 0xFF);
+  regp->control = (uint8_t) ((values[0] >> 24) & 0xFF);
+  regp->fpscr = values[1];
+
+  for (uint32_t i = 0; i < 32; i++) { regp->s[i] = values[2 + i]; }
+
+  return (0);
+}
+
 int32_t stlink_read_all_unsupported_regs(stlink_t *sl, struct stlink_reg *regp) {
   DLOG("*** stlink_read_all_unsupported_regs ***\n");
+
+  if (sl->backend->debug32_batch) { return (stlink_read_all_unsupported_regs_batched(sl, regp)); }
+
   return (sl->backend->read_all_unsupported_regs(sl, regp));
 }
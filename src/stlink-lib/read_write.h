@@ -14,9 +14,15 @@ void write_uint32(unsigned char *buf, uint32_t ui);
 
 int32_t stlink_read_debug32(stlink_t *sl, uint32_t addr, uint32_t *data);
 int32_t stlink_write_debug32(stlink_t *sl, uint32_t addr, uint32_t data);
+void stlink_debug32_begin(stlink_t *sl);
+int32_t stlink_debug32_queue_read(stlink_t *sl, uint32_t addr, uint32_t *data, int32_t *error);
+int32_t stlink_debug32_queue_write(stlink_t *sl, uint32_t addr, uint32_t data, int32_t *error);
+int32_t stlink_debug32_flush(stlink_t *sl);
 int32_t stlink_read_mem32(stlink_t *sl, uint32_t addr, uint16_t len);
 int32_t stlink_write_mem32(stlink_t *sl, uint32_t addr, uint16_t len);
 int32_t stlink_write_mem8(stlink_t *sl, uint32_t addr, uint16_t len);
+int32_t stlink_read_mem(stlink_t *sl, uint32_t addr, uint32_t len, uint8_t *dst);
+int32_t stlink_write_mem(stlink_t *sl, uint32_t addr, uint32_t len, const uint8_t *src);
 int32_t stlink_read_reg(stlink_t *sl, int32_t r_idx, struct stlink_reg *regp);
 int32_t stlink_write_reg(stlink_t *sl, uint32_t reg, int32_t idx);
 int32_t stlink_read_unsupported_reg(stlink_t *sl, int32_t r_idx, struct stlink_reg *regp);
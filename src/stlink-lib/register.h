@@ -40,6 +40,9 @@
 /* Hard Fault Status Register */
 #define STLINK_REG_HFSR                     0xE000ED2C
 
+/* Media and FP Feature Register 0, reads 0 on cores without FPU */
+#define STLINK_REG_MVFR0                    0xE000EF40
+
 /* Debug Halting Control and Status Register */
 #define STLINK_REG_DFSR                     0xE000ED30
 #define STLINK_REG_DFSR_HALT                (1 << 0)
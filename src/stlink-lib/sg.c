@@ -963,6 +963,9 @@ static stlink_backend_t _stlink_sg_backend = {
     NULL,                   // trace_enable
     NULL,                   // trace_disable
     NULL,                   // trace_read
+    NULL,                   // debug32_batch
+    NULL,                   // read_mem
+    NULL,                   // write_mem
 };
 
 static stlink_t* stlink_open(const int32_t verbose) {
@@ -30,6 +30,16 @@
 #include "read_write.h"
 #include "register.h"
 
+// one bulk transfer of a pipelined request
+struct usb_xfer {
+    uint32_t endpoint;
+    unsigned char* buf;
+    uint32_t size;
+    int32_t actual;
+    int32_t error;
+    int32_t done;
+};
+
 static inline uint32_t le_to_h_u32(const uint8_t* buf) {
     return ((uint32_t) ((uint32_t) buf[0] | (uint32_t) buf[1] << 8 | (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24));
 }
@@ -91,6 +101,127 @@ void _stlink_usb_close(stlink_t* sl) {
     }
 }
 
+static void LIBUSB_CALL usb_xfer_done(struct libusb_transfer *transfer) {
+    struct usb_xfer *xfer = transfer->user_data;
+
+    xfer->actual = transfer->actual_length;
+
+    switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED: xfer->error = 0; break;
+    case LIBUSB_TRANSFER_TIMED_OUT: xfer->error = LIBUSB_ERROR_TIMEOUT; break;
+    case LIBUSB_TRANSFER_STALL: xfer->error = LIBUSB_ERROR_PIPE; break;
+    case LIBUSB_TRANSFER_OVERFLOW: xfer->error = LIBUSB_ERROR_OVERFLOW; break;
+    case LIBUSB_TRANSFER_NO_DEVICE: xfer->error = LIBUSB_ERROR_NO_DEVICE; break;
+    case LIBUSB_TRANSFER_CANCELLED: xfer->error = LIBUSB_ERROR_INTERRUPTED; break;
+    default: xfer->error = LIBUSB_ERROR_IO; break;
+    }
+
+    xfer->done = 1;
+}
+
+/*
+ * Run a list of bulk transfers through the libusb asynchronous API.
+ * Transfers are submitted in list order with up to STLINK_USB_PIPE_DEPTH of them
+ * in flight, so the probe always has the next request queued while we still wait
+ * for the previous reply. Transfers on one endpoint complete in submission order.
+ * On the first failure no further transfers are submitted and the ones in flight
+ * are cancelled. If event handling keeps failing after that, the cancelled
+ * transfers may never complete; they are given up after STLINK_USB_EVENT_RETRIES
+ * attempts and left allocated, as libusb may still own them.
+ */
+static int32_t usb_xfer_run(struct stlink_libusb* handle, struct usb_xfer *xfer, uint32_t count, const char *cmd) {
+    struct libusb_transfer **transfers;
+    uint32_t submitted = 0, completed = 0, event_errors = 0, i;
+    int32_t failed = 0, cancelled = 0, t;
+
+    transfers = calloc(count, sizeof(struct libusb_transfer *));
+    if (transfers == NULL) { return (-1); }
+
+    for (i = 0; i < count; i++) {
+        transfers[i] = libusb_alloc_transfer(0);
+
+        if (transfers[i] == NULL) {
+            failed = 1;
+            count = i;
+            break;
+        }
+
+        xfer[i].actual = 0;
+        xfer[i].error = 0;
+        xfer[i].done = 0;
+        libusb_fill_bulk_transfer(transfers[i], handle->usb_handle, (unsigned char) xfer[i].endpoint,
+                                  xfer[i].buf, (int32_t) xfer[i].size, usb_xfer_done, &xfer[i], 3000);
+    }
+
+    while (completed < submitted || (!failed && submitted < count)) {
+        while (!failed && submitted < count && submitted - completed < STLINK_USB_PIPE_DEPTH) {
+            t = libusb_submit_transfer(transfers[submitted]);
+
+            if (t) {
+                ELOG("%s submit transfer failed: %s\n", cmd, libusb_error_name(t));
+                failed = 1;
+                break;
+            }
+
+            submitted++;
+        }
+
+        if (failed && !cancelled) {
+            for (i = completed; i < submitted; i++) {
+                if (!xfer[i].done) { libusb_cancel_transfer(transfers[i]); }
+            }
+
+            cancelled = 1;
+        }
+
+        if (completed == submitted) { break; }
+
+        t = libusb_handle_events_completed(handle->libusb_ctx, NULL);
+
+        if (t && t != LIBUSB_ERROR_INTERRUPTED) {
+            ELOG("%s handle events failed: %s\n", cmd, libusb_error_name(t));
+
+            if (failed && ++event_errors > STLINK_USB_EVENT_RETRIES) {
+                ELOG("%s giving up on %u transfers in flight\n", cmd, submitted - completed);
+
+                for (i = 0; i < count; i++) {
+                    if (i >= submitted || xfer[i].done) { libusb_free_transfer(transfers[i]); }
+                }
+
+                free(transfers);
+                return (-1);
+            }
+
+            failed = 1;
+        }
+
+        // transfers complete in order per endpoint, but not across endpoints
+        for (i = completed; i < submitted; i++) {
+            if (!xfer[i].done) { continue; }
+
+            if (xfer[i].error && !failed) {
+                ELOG("%s %s failed: %s\n", cmd,
+                     (xfer[i].endpoint & LIBUSB_ENDPOINT_IN) ? "read reply" : "send request",
+                     libusb_error_name(xfer[i].error));
+                failed = 1;
+            }
+        }
+
+        while (completed < submitted && xfer[completed].done) { completed++; }
+    }
+
+    for (i = 0; i < count; i++) { libusb_free_transfer(transfers[i]); }
+
+    free(transfers);
+    return (failed ? -1 : 0);
+}
+
+static inline void usb_xfer_set(struct usb_xfer *xfer, uint32_t endpoint, unsigned char* buf, uint32_t size) {
+    xfer->endpoint = endpoint;
+    xfer->buf = buf;
+    xfer->size = size;
+}
+
 ssize_t send_recv(struct stlink_libusb* handle, int32_t terminate, unsigned char* txbuf, uint32_t txsize,
                     unsigned char* rxbuf, uint32_t rxsize, int32_t check_error, const char *cmd) {
     // Note: txbuf and rxbuf can point to the same area
@@ -98,23 +229,43 @@ ssize_t send_recv(struct stlink_libusb* handle, int32_t terminate, unsigned char
 
     while (1) {
         res = 0;
-        t = libusb_bulk_transfer(handle->usb_handle, handle->ep_req, txbuf, (int32_t) txsize, &res, 3000);
 
-        if (t) {
-            ELOG("%s send request failed: %s\n", cmd, libusb_error_name(t));
-            return (-1);
-        } else if ((size_t) res != txsize) {
-            ELOG("%s send request wrote %u bytes, instead of %u\n", cmd, (uint32_t) res, (uint32_t) txsize);
-        }
+        if (handle->protocoll != 1 && rxsize != 0 && txbuf != rxbuf) {
+            // queue request and reply together, the reply transfer is already pending
+            // when the probe answers
+            struct usb_xfer xfer[2] = {
+                { handle->ep_req, txbuf, txsize, 0, 0, 0 },
+                { handle->ep_rep, rxbuf, rxsize, 0, 0, 0 },
+            };
 
-        if (rxsize != 0) {
-            t = libusb_bulk_transfer(handle->usb_handle, handle->ep_rep, rxbuf, (int32_t) rxsize, &res, 3000);
+            if (usb_xfer_run(handle, xfer, 2, cmd)) { return (-1); }
+
+            if (xfer[0].actual != (int32_t) txsize) {
+                ELOG("%s send request wrote %u bytes, instead of %u\n", cmd, (uint32_t) xfer[0].actual, (uint32_t) txsize);
+            }
+
+            res = xfer[1].actual;
+        } else {
+            t = libusb_bulk_transfer(handle->usb_handle, handle->ep_req, txbuf, (int32_t) txsize, &res, 3000);
 
             if (t) {
-                ELOG("%s read reply failed: %s\n", cmd, libusb_error_name(t));
+                ELOG("%s send request failed: %s\n", cmd, libusb_error_name(t));
                 return (-1);
+            } else if ((size_t) res != txsize) {
+                ELOG("%s send request wrote %u bytes, instead of %u\n", cmd, (uint32_t) res, (uint32_t) txsize);
             }
 
+            if (rxsize != 0) {
+                t = libusb_bulk_transfer(handle->usb_handle, handle->ep_rep, rxbuf, (int32_t) rxsize, &res, 3000);
+
+                if (t) {
+                    ELOG("%s read reply failed: %s\n", cmd, libusb_error_name(t));
+                    return (-1);
+                }
+            }
+        }
+
+        if (rxsize != 0) {
             /* Checking the command execution status stored in the first byte of the response */
             if (handle->protocoll != 1 && check_error >= CMD_CHECK_STATUS && 
                         rxbuf[0] != STLINK_DEBUG_ERR_OK) {
@@ -288,6 +439,102 @@ int32_t _stlink_usb_write_debug32(stlink_t *sl, uint32_t addr, uint32_t data) {
     return (size < 0 ? -1 : 0);
 }
 
+/*
+ * Send a list of READDEBUGREG/WRITEDEBUGREG commands as one pipelined burst.
+ * The status of every access is taken from its own reply. From the first access
+ * answered with AP_WAIT/DP_WAIT on, all accesses are sent again one by one, in
+ * queue order and with the retries of the single commands, so that every one
+ * of them follows the accesses queued before it.
+ */
+int32_t _stlink_usb_debug32_batch(stlink_t *sl, stlink_debug32_op_t *ops, uint32_t count) {
+    struct stlink_libusb * const slu = sl->backend_data;
+    const uint32_t stride = STLINK_CMD_SIZE + 8;
+    uint32_t n;
+    int32_t ret = 0, burst;
+    bool replay = false;
+
+    if (slu->protocoll == 1) {
+        for (n = 0; n < count; n++) {
+            if (ops[n].result) {
+                ops[n].status = _stlink_usb_read_debug32(sl, ops[n].addr, ops[n].result);
+            } else {
+                ops[n].status = _stlink_usb_write_debug32(sl, ops[n].addr, ops[n].data);
+            }
+
+            if (ops[n].status) { ret = -1; }
+        }
+
+        return (ret);
+    }
+
+    unsigned char *bufs = calloc(count, stride);
+    struct usb_xfer *xfer = calloc(count * 2, sizeof(struct usb_xfer));
+
+    if (bufs == NULL || xfer == NULL) {
+        free(bufs);
+        free(xfer);
+
+        for (n = 0; n < count; n++) { ops[n].status = -1; }
+
+        return (-1);
+    }
+
+    for (n = 0; n < count; n++) {
+        unsigned char* const cmd = &bufs[n * stride];
+        unsigned char* const rep = cmd + STLINK_CMD_SIZE;
+
+        cmd[0] = STLINK_DEBUG_COMMAND;
+        write_uint32(&cmd[2], ops[n].addr);
+
+        if (ops[n].result) {
+            cmd[1] = STLINK_DEBUG_APIV2_READDEBUGREG;
+            usb_xfer_set(&xfer[2 * n + 1], slu->ep_rep, rep, 8);
+        } else {
+            cmd[1] = STLINK_DEBUG_APIV2_WRITEDEBUGREG;
+            write_uint32(&cmd[6], ops[n].data);
+            usb_xfer_set(&xfer[2 * n + 1], slu->ep_rep, rep, 2);
+        }
+
+        usb_xfer_set(&xfer[2 * n], slu->ep_req, cmd, slu->cmd_len);
+    }
+
+    burst = usb_xfer_run(slu, xfer, count * 2, "DEBUGREG_BATCH");
+
+    for (n = 0; n < count; n++) {
+        unsigned char* const rep = &bufs[n * stride + STLINK_CMD_SIZE];
+
+        if (!replay && !burst && xfer[2 * n + 1].done && !xfer[2 * n + 1].error &&
+            (rep[0] == STLINK_DEBUG_ERR_AP_WAIT || rep[0] == STLINK_DEBUG_ERR_DP_WAIT)) {
+            DLOG("DEBUGREG_BATCH access %u to %#010x wait error (0x%02X), replaying from here\n",
+                 n, ops[n].addr, rep[0]);
+            replay = true;
+        }
+
+        if (replay) {
+            if (ops[n].result) {
+                ops[n].status = _stlink_usb_read_debug32(sl, ops[n].addr, ops[n].result);
+            } else {
+                ops[n].status = _stlink_usb_write_debug32(sl, ops[n].addr, ops[n].data);
+            }
+        } else if (burst || !xfer[2 * n + 1].done || xfer[2 * n + 1].error) {
+            ops[n].status = -1;
+        } else if (rep[0] != STLINK_DEBUG_ERR_OK) {
+            DLOG("DEBUGREG_BATCH access %u to %#010x error (0x%02X)\n", n, ops[n].addr, rep[0]);
+            ops[n].status = -1;
+        } else {
+            ops[n].status = 0;
+
+            if (ops[n].result) { *ops[n].result = read_uint32(rep, 4); }
+        }
+
+        if (ops[n].status) { ret = -1; }
+    }
+
+    free(bufs);
+    free(xfer);
+    return (ret);
+}
+
 int32_t _stlink_usb_get_rw_status(stlink_t *sl) {
     if (sl->version.jtag_api == STLINK_JTAG_API_V1) { return (0); }
 
@@ -311,12 +558,80 @@ int32_t _stlink_usb_get_rw_status(stlink_t *sl) {
     return (ret < 0 ? -1 : 0);
 }
 
+/*
+ * Large writes are split into sl->xfer_caps.rw32_cmd_size sized WRITEMEM_32BIT commands.
+ * Each chunk is followed by its GETLASTRWSTATUS and all of them are queued back to back,
+ * so the probe can write the next chunk to the target while we collect the status.
+ */
+static int32_t _stlink_usb_write_mem32_pipelined(stlink_t *sl, uint32_t addr, uint32_t len, const uint8_t *data) {
+    struct stlink_libusb * const slu = sl->backend_data;
+    const uint32_t chunk = sl->xfer_caps.rw32_cmd_size;
+    const uint32_t chunks = (len + chunk - 1) / chunk;
+    const uint32_t stride = 2 * STLINK_CMD_SIZE + 12;
+    const bool rw_status = sl->version.jtag_api != STLINK_JTAG_API_V1;
+    const bool rw_status2 = (sl->version.flags & STLINK_F_HAS_GETLASTRWSTATUS2) != 0;
+    const uint32_t per_chunk = rw_status ? 4 : 2;
+    uint32_t n;
+    int32_t ret;
+
+    unsigned char *bufs = calloc(chunks, stride);
+    struct usb_xfer *xfer = calloc(chunks * per_chunk, sizeof(struct usb_xfer));
+
+    if (bufs == NULL || xfer == NULL) {
+        free(bufs);
+        free(xfer);
+        return (-1);
+    }
+
+    for (n = 0; n < chunks; n++) {
+        uint32_t offset = n * chunk;
+        uint32_t size = (len - offset > chunk) ? chunk : len - offset;
+        unsigned char* const cmd = &bufs[n * stride];
+        unsigned char* const status_cmd = cmd + STLINK_CMD_SIZE;
+        unsigned char* const status = status_cmd + STLINK_CMD_SIZE;
+        struct usb_xfer *x = &xfer[n * per_chunk];
+
+        cmd[0] = STLINK_DEBUG_COMMAND;
+        cmd[1] = STLINK_DEBUG_WRITEMEM_32BIT;
+        write_uint32(&cmd[2], addr + offset);
+        write_uint16(&cmd[6], (uint16_t) size);
+        usb_xfer_set(&x[0], slu->ep_req, cmd, slu->cmd_len);
+        usb_xfer_set(&x[1], slu->ep_req, (unsigned char*) data + offset, size);
+
+        if (rw_status) {
+            status_cmd[0] = STLINK_DEBUG_COMMAND;
+            status_cmd[1] = rw_status2 ? STLINK_DEBUG_APIV2_GETLASTRWSTATUS2 : STLINK_DEBUG_APIV2_GETLASTRWSTATUS;
+            usb_xfer_set(&x[2], slu->ep_req, status_cmd, slu->cmd_len);
+            usb_xfer_set(&x[3], slu->ep_rep, status, rw_status2 ? 12 : 2);
+        }
+    }
+
+    ret = usb_xfer_run(slu, xfer, chunks * per_chunk, "WRITEMEM_32BIT");
+
+    for (n = 0; ret == 0 && rw_status && n < chunks; n++) {
+        unsigned char* const status = &bufs[n * stride + 2 * STLINK_CMD_SIZE];
+
+        if (status[0] != STLINK_DEBUG_ERR_OK) {
+            DLOG("WRITEMEM_32BIT error (0x%02X) at %#x\n", status[0], addr + n * chunk);
+            ret = -1;
+        }
+    }
+
+    free(bufs);
+    free(xfer);
+    return (ret);
+}
+
 int32_t _stlink_usb_write_mem32(stlink_t *sl, uint32_t addr, uint16_t len) {
     struct stlink_libusb * const slu = sl->backend_data;
     unsigned char* const data = sl->q_buf;
     unsigned char* const cmd  = sl->c_buf;
     int32_t i, ret;
 
+    if (slu->protocoll != 1 && len > sl->xfer_caps.rw32_cmd_size) {
+        return (_stlink_usb_write_mem32_pipelined(sl, addr, len, data));
+    }
+
     i = fill_command(sl, SG_DXFER_TO_DEV, len);
     cmd[i++] = STLINK_DEBUG_COMMAND;
     cmd[i++] = STLINK_DEBUG_WRITEMEM_32BIT;
@@ -339,8 +654,7 @@ int32_t _stlink_usb_write_mem8(stlink_t *sl, uint32_t addr, uint16_t len) {
     unsigned char* const cmd  = sl->c_buf;
     int32_t i, ret;
 
-    if ((sl->version.jtag_api < STLINK_JTAG_API_V3 && len > 64) ||
-        (sl->version.jtag_api >= STLINK_JTAG_API_V3 && len > 512)) {
+    if (len > sl->xfer_caps.max_rw8) {
         ELOG("WRITEMEM_8BIT: bulk packet limits exceeded (data len %d byte)\n", len);
         return (-1);
     }
@@ -711,11 +1025,68 @@ int32_t _stlink_usb_exit_debug_mode(stlink_t *sl) {
     return (size < 0 ? -1 : 0);
 }
 
+/*
+ * Large reads are split into sl->xfer_caps.rw32_cmd_size sized READMEM_32BIT commands which
+ * are queued together with their replies, so the probe reads the next chunk from the
+ * target while the previous one is transferred over USB.
+ * Returns the number of bytes read or -1 on error.
+ */
+static int32_t _stlink_usb_read_mem32_pipelined(stlink_t *sl, uint32_t addr, uint32_t len, uint8_t *data) {
+    struct stlink_libusb * const slu = sl->backend_data;
+    const uint32_t chunk = sl->xfer_caps.rw32_cmd_size;
+    const uint32_t chunks = (len + chunk - 1) / chunk;
+    uint32_t n;
+    int32_t ret;
+
+    unsigned char *cmds = calloc(chunks, STLINK_CMD_SIZE);
+    struct usb_xfer *xfer = calloc(chunks * 2, sizeof(struct usb_xfer));
+
+    if (cmds == NULL || xfer == NULL) {
+        free(cmds);
+        free(xfer);
+        return (-1);
+    }
+
+    for (n = 0; n < chunks; n++) {
+        uint32_t offset = n * chunk;
+        uint32_t size = (len - offset > chunk) ? chunk : len - offset;
+        unsigned char* const cmd = &cmds[n * STLINK_CMD_SIZE];
+
+        cmd[0] = STLINK_DEBUG_COMMAND;
+        cmd[1] = STLINK_DEBUG_READMEM_32BIT;
+        write_uint32(&cmd[2], addr + offset);
+        write_uint16(&cmd[6], (uint16_t) size);
+        usb_xfer_set(&xfer[2 * n], slu->ep_req, cmd, slu->cmd_len);
+        usb_xfer_set(&xfer[2 * n + 1], slu->ep_rep, data + offset, size);
+    }
+
+    ret = usb_xfer_run(slu, xfer, chunks * 2, "READMEM_32BIT");
+
+    if (ret == 0) {
+        for (n = 0; n < chunks; n++) { ret += xfer[2 * n + 1].actual; }
+    }
+
+    free(cmds);
+    free(xfer);
+    return (ret);
+}
+
 int32_t _stlink_usb_read_mem32(stlink_t *sl, uint32_t addr, uint16_t len) {
     struct stlink_libusb * const slu = sl->backend_data;
     unsigned char* const data = sl->q_buf;
     unsigned char* const cmd = sl->c_buf;
     ssize_t size;
+
+    if (slu->protocoll != 1 && len > sl->xfer_caps.rw32_cmd_size) {
+        int32_t ret = _stlink_usb_read_mem32_pipelined(sl, addr, len, data);
+
+        if (ret < 0) { return (-1); }
+
+        sl->q_len = ret;
+        stlink_print_data(sl);
+        return (0);
+    }
+
     int32_t i = fill_command(sl, SG_DXFER_FROM_DEV, len);
 
     cmd[i++] = STLINK_DEBUG_COMMAND;
@@ -734,6 +1105,107 @@ int32_t _stlink_usb_read_mem32(stlink_t *sl, uint32_t addr, uint16_t len) {
     return (0);
 }
 
+/*
+ * Read len bytes at any address straight into the caller's buffer.
+ * Unaligned head and tail bytes are taken from a word read through q_buf,
+ * the aligned part is transferred without any copy.
+ */
+int32_t _stlink_usb_read_mem(stlink_t *sl, uint32_t addr, uint32_t len, uint8_t *dst) {
+    struct stlink_libusb * const slu = sl->backend_data;
+    uint32_t head = addr & 3;
+    uint32_t size;
+
+    if (head && len) {
+        size = (len < 4 - head) ? len : 4 - head;
+
+        if (_stlink_usb_read_mem32(sl, addr - head, 4)) { return (-1); }
+
+        memcpy(dst, sl->q_buf + head, size);
+        addr += size;
+        dst += size;
+        len -= size;
+    }
+
+    size = len & ~3u;
+
+    if (size && slu->protocoll != 1) {
+        if (_stlink_usb_read_mem32_pipelined(sl, addr, size, dst) < 0) { return (-1); }
+
+        addr += size;
+        dst += size;
+        len -= size;
+    }
+
+    // V1 protocol: aligned words by xfer_caps.block_size through q_buf, then the tail
+    while (len) {
+        size = (len >= 4) ? (len & ~3u) : 4;
+
+        if (size > sl->xfer_caps.block_size) { size = sl->xfer_caps.block_size; }
+
+        if (_stlink_usb_read_mem32(sl, addr, (uint16_t) size)) { return (-1); }
+
+        if (size > len) { size = len; }
+
+        memcpy(dst, sl->q_buf, size);
+        addr += size;
+        dst += size;
+        len -= size;
+    }
+
+    return (0);
+}
+
+/*
+ * Write len bytes to any address straight from the caller's buffer.
+ * Unaligned head and tail bytes are written with WRITEMEM_8BIT through q_buf,
+ * the aligned part is transferred without any copy.
+ */
+int32_t _stlink_usb_write_mem(stlink_t *sl, uint32_t addr, uint32_t len, const uint8_t *src) {
+    struct stlink_libusb * const slu = sl->backend_data;
+    uint32_t head = addr & 3;
+    uint32_t size;
+
+    if (head && len) {
+        size = (len < 4 - head) ? len : 4 - head;
+        memcpy(sl->q_buf, src, size);
+
+        if (_stlink_usb_write_mem8(sl, addr, (uint16_t) size)) { return (-1); }
+
+        addr += size;
+        src += size;
+        len -= size;
+    }
+
+    size = len & ~3u;
+
+    if (size && slu->protocoll != 1) {
+        if (_stlink_usb_write_mem32_pipelined(sl, addr, size, src)) { return (-1); }
+
+        addr += size;
+        src += size;
+        len -= size;
+    }
+
+    while (len >= 4) {
+        size = (len & ~3u) > sl->xfer_caps.block_size ? sl->xfer_caps.block_size : (len & ~3u);
+        memcpy(sl->q_buf, src, size);
+
+        if (_stlink_usb_write_mem32(sl, addr, (uint16_t) size)) { return (-1); }
+
+        addr += size;
+        src += size;
+        len -= size;
+    }
+
+    if (len) {
+        memcpy(sl->q_buf, src, len);
+
+        if (_stlink_usb_write_mem8(sl, addr, (uint16_t) len)) { return (-1); }
+    }
+
+    return (0);
+}
+
 int32_t _stlink_usb_read_all_regs(stlink_t *sl, struct stlink_reg *regp) {
     struct stlink_libusb * const slu = sl->backend_data;
     unsigned char* const cmd = sl->c_buf;
@@ -1080,7 +1552,10 @@ static stlink_backend_t _stlink_usb_backend = {
     _stlink_usb_set_swdclk,
     _stlink_usb_enable_trace,
     _stlink_usb_disable_trace,
-    _stlink_usb_read_trace
+    _stlink_usb_read_trace,
+    _stlink_usb_debug32_batch,
+    _stlink_usb_read_mem,
+    _stlink_usb_write_mem
 };
 
 /* return the length of serial or (0) in case of errors */
@@ -1268,9 +1743,14 @@ stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect,
     slu->sg_transfer_idx = 0;
     slu->cmd_len = (slu->protocoll == 1) ? STLINK_SG_SIZE : STLINK_CMD_SIZE;
 
-    // initialize stlink version (sl->version)
+    // initialize stlink version (sl->version) and transfer limits (sl->xfer_caps)
     stlink_version(sl);
 
+    if (slu->protocoll != 1) {
+        // large blocks are split into pipelined commands, see usb_xfer_run()
+        sl->xfer_caps.block_size = STLINK_BLOCK_SIZE_PIPELINED;
+    }
+
     int32_t mode = stlink_current_mode(sl);
     if (mode == STLINK_DEV_DFU_MODE) {
         DLOG("-- exit_dfu_mode\n");
@@ -1431,3 +1911,55 @@ void stlink_probe_usb_free(stlink_t ***stdevs, uint32_t size) {
     free(*stdevs);
     *stdevs = NULL;
 }
+
+/* Serial numbers of all connected ST-Links, the probes are not opened for debugging */
+uint32_t stlink_probe_usb_serials(char (**serials)[STLINK_SERIAL_BUFFER_SIZE]) {
+    libusb_context *ctx = NULL;
+    libusb_device **devs;
+    char (*list)[STLINK_SERIAL_BUFFER_SIZE];
+    uint32_t n = 0;
+    ssize_t cnt;
+
+    *serials = NULL;
+
+    if (libusb_init(&ctx) < 0) { return (0); }
+
+    cnt = libusb_get_device_list(ctx, &devs);
+
+    if (cnt < 0) {
+        libusb_exit(ctx);
+        return (0);
+    }
+
+    list = calloc(cnt + 1, sizeof(*list));
+
+    for (ssize_t i = 0; list != NULL && i < cnt; i++) {
+        struct libusb_device_descriptor desc;
+        struct libusb_device_handle *handle;
+
+        if (libusb_get_device_descriptor(devs[i], &desc) < 0 ||
+            desc.idVendor != STLINK_USB_VID_ST || !STLINK_SUPPORTED_USB_PID(desc.idProduct)) {
+            continue;
+        }
+
+        if (libusb_open(devs[i], &handle) < 0) {
+            WLOG("Could not open USB device %#06x:%#06x\n", desc.idVendor, desc.idProduct);
+            continue;
+        }
+
+        if (stlink_serial(handle, &desc, list[n]) == STLINK_SERIAL_LENGTH) { n++; }
+
+        libusb_close(handle);
+    }
+
+    libusb_free_device_list(devs, 1);
+    libusb_exit(ctx);
+
+    if (n == 0) {
+        free(list);
+        list = NULL;
+    }
+
+    *serials = list;
+    return (n);
+}
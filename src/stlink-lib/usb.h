@@ -48,6 +48,11 @@
 #define STLINK_SG_SIZE 31
 #define STLINK_CMD_SIZE 16
 
+// asynchronous transport: max. transfers in flight
+// (pipelined memory accesses are split by sl->xfer_caps.rw32_cmd_size)
+#define STLINK_USB_PIPE_DEPTH 8
+#define STLINK_USB_EVENT_RETRIES 4 // event handling errors tolerated after a failure
+
 enum SCSI_Generic_Direction {SG_DXFER_TO_DEV = 0, SG_DXFER_FROM_DEV = 0x80};
 
 struct stlink_libusb {
@@ -73,6 +78,7 @@ int32_t _stlink_usb_version(stlink_t *sl);
 int32_t _stlink_usb_target_voltage(stlink_t *sl);
 int32_t _stlink_usb_read_debug32(stlink_t *sl, uint32_t addr, uint32_t *data);
 int32_t _stlink_usb_write_debug32(stlink_t *sl, uint32_t addr, uint32_t data);
+int32_t _stlink_usb_debug32_batch(stlink_t *sl, stlink_debug32_op_t *ops, uint32_t count);
 int32_t _stlink_usb_get_rw_status(stlink_t *sl);
 int32_t _stlink_usb_write_mem32(stlink_t *sl, uint32_t addr, uint16_t len);
 int32_t _stlink_usb_write_mem8(stlink_t *sl, uint32_t addr, uint16_t len);
@@ -90,6 +96,8 @@ int32_t _stlink_usb_run(stlink_t* sl, enum run_type type);
 int32_t _stlink_usb_set_swdclk(stlink_t* sl, int32_t clk_freq);
 int32_t _stlink_usb_exit_debug_mode(stlink_t *sl);
 int32_t _stlink_usb_read_mem32(stlink_t *sl, uint32_t addr, uint16_t len);
+int32_t _stlink_usb_read_mem(stlink_t *sl, uint32_t addr, uint32_t len, uint8_t *dst);
+int32_t _stlink_usb_write_mem(stlink_t *sl, uint32_t addr, uint32_t len, const uint8_t *src);
 int32_t _stlink_usb_read_all_regs(stlink_t *sl, struct stlink_reg *regp);
 int32_t _stlink_usb_read_reg(stlink_t *sl, int32_t r_idx, struct stlink_reg *regp);
 int32_t _stlink_usb_read_unsupported_reg(stlink_t *sl, int32_t r_idx, struct stlink_reg *regp);
@@ -107,5 +115,6 @@ stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect,
 // static uint32_t stlink_probe_usb_devs(libusb_device **devs, stlink_t **sldevs[], enum connect_type connect, int32_t freq);
 uint32_t stlink_probe_usb(stlink_t **stdevs[], enum connect_type connect, int32_t freq);
 void stlink_probe_usb_free(stlink_t **stdevs[], uint32_t size);
+uint32_t stlink_probe_usb_serials(char (**serials)[STLINK_SERIAL_BUFFER_SIZE]);
 
 #endif // USB_H
@@ -72,6 +72,10 @@ static bool execute_test(const struct Test * test) {
         ret &= (opts.log_level == test->opts.log_level);
         ret &= (opts.freq == test->opts.freq);
         ret &= (opts.format == test->opts.format);
+        ret &= (opts.delta == test->opts.delta);
+        ret &= (opts.blank_check == test->opts.blank_check);
+        ret &= (opts.gang == test->opts.gang);
+        ret &= (opts.compress == test->opts.compress);
     }
 
     printf("[%s] (%d) %s\n", ret ? "OK" : "ERROR", res, test->cmd_line);
@@ -204,6 +208,56 @@ static struct Test tests[] = {
         .freq = 0,
         .format = FLASH_FORMAT_BINARY }
     },
+    { "--delta write test.bin 0x80000000", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.bin",
+        .addr = 0x80000000,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .delta = 1,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY }
+    },
+    { "--blank-check write test.bin 0x80000000", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.bin",
+        .addr = 0x80000000,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .blank_check = 1,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY }
+    },
+    { "--compress write test.bin 0x80000000", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.bin",
+        .addr = 0x80000000,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .compress = 1,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY }
+    },
+    { "--gang --reset --format=ihex write test.hex", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.hex",
+        .addr = 0,
+        .size = 0,
+        .reset = 1,
+        .log_level = STND_LOG_LEVEL,
+        .gang = 1,
+        .freq = 0,
+        .format = FLASH_FORMAT_IHEX }
+    },
+    { "--gang --serial ABCEFF544851717867216044 write test.bin 0x80000000", -1, FLASH_OPTS_INITIALIZER },
+    { "--gang read test.bin 0x80000000 0x1000", -1, FLASH_OPTS_INITIALIZER },
     { "--debug --reset --format=ihex write test.hex", 0,
       { .cmd = FLASH_CMD_WRITE,
         .serial = { 0 },
@@ -215,6 +269,32 @@ static struct Test tests[] = {
         .freq = 0,
         .format = FLASH_FORMAT_IHEX }
     },
+    { "--format elf write test.elf", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.elf",
+        .addr = 0,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_ELF }
+    },
+    { "--format elf write test.elf 0x80000000", -1, FLASH_OPTS_INITIALIZER },
+    { "--format elf read test.elf 0x80000000 0x1000", -1, FLASH_OPTS_INITIALIZER },
+    { "--reset --format=manifest write images.ini", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "images.ini",
+        .addr = 0,
+        .size = 0,
+        .reset = 1,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_MANIFEST }
+    },
+    { "--format manifest write images.ini 0x08000000", -1, FLASH_OPTS_INITIALIZER },
+    { "--format manifest read images.ini 0x08000000 0x1000", -1, FLASH_OPTS_INITIALIZER },
     { "--debug --reset --format=binary write test.hex", -1, FLASH_OPTS_INITIALIZER },
     { "--debug --reset --format=ihex write test.hex 0x80000000", -1, FLASH_OPTS_INITIALIZER },
     { "--debug --reset write test.hex sometext", -1, FLASH_OPTS_INITIALIZER },